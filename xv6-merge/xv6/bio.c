@@ -1,39 +1,78 @@
 // Buffer cache.
 //
 // The buffer cache is a linked list of buf structures holding
-// cached copies of disk block contents.  Caching disk blocks
-// in memory reduces the number of disk reads and also provides
-// a synchronization point for disk blocks used by multiple processes.
+// cached copies of disk block contents.  A block is BSIZE bytes,
+// SPB disk sectors; bread and friends take block numbers.
+// Caching disk blocks in memory reduces the number of disk reads
+// and also provides a synchronization point for disk blocks used
+// by multiple processes.
 // 
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to flush it to disk.
+// * After changing buffer data, call bwrite to mark it dirty.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * To force dirty buffers out to disk, call bsync.
+// * File system metadata is written with log_write (log.c),
+//     which pins the buffer until its transaction commits.
+//
+// Writes are delayed: a dirty buffer stays in the cache, so
+// repeated updates to the same block (bitmap, inode, directory)
+// coalesce into a single disk write.  The bflusher kernel process
+// writes dirty buffers back once they are FLUSHAGE ticks old or
+// when the cache fills up with them, and bget writes back a
+// dirty buffer before recycling it.
 // 
-// The implementation uses three state flags internally:
+// If the superblock says so (see fsinit), ROOTDEV is a RAID-0
+// array striped over IDE disks ROOTDEV and STRIPEDEV, which sit
+// on different IDE channels: chunk c of ROOTDEV is chunk c/2 of
+// ROOTDEV if c is even and of STRIPEDEV if c is odd.  bread maps
+// blocks to the sectors where they live, so buffers name physical
+// sectors.  b->blockno keeps the block number the file system
+// asked for.
+//
+// File contents do not live here but in the page cache
+// (pcache.c), which does its own I/O with bdirect.  So there is
+// no readahead here either: pgetfile in fs.c reads the pages
+// after a sequential reader's in the same batch of requests as
+// the one it needs, which keeps both disks of a stripe busy
+// without buffers that no process owns while they are read.
+//
+// The implementation uses four state flags internally:
 // * B_BUSY: the block has been returned from bread
 //     and has not been passed back to brelse.  
 // * B_VALID: the buffer data has been initialized
 //     with the associated disk block contents.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_LOG: the buffer is dirty and part of the log's running
+//     transaction, so it must stay in the cache and must not be
+//     written back until the transaction has committed.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
 #include "buf.h"
+#include "fs.h"
+#include "stat.h"
 
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
+  uchar data[NBUF][BSIZE];
 
   // Linked list of all buffers, through prev/next.
   // head.next is most recently used.
   struct buf head;
+
+  int ndirty;   // number of buffers with B_DIRTY set
+  int waiting;  // someone is waiting for any buffer to be free
+  uint stripe;  // chunk size in sectors if ROOTDEV is striped
+  uint nread;   // sectors read from disk
+  uint nwrite;  // sectors written to disk
 } bcache;
 
 void
@@ -50,11 +89,55 @@ binit(void)
     b->next = bcache.head.next;
     b->prev = &bcache.head;
     b->dev = -1;
+    b->data = bcache.data[b - bcache.buf];
+    b->nsect = SPB;
     bcache.head.next->prev = b;
     bcache.head.next = b;
   }
 }
 
+static void bflush1(struct buf*);
+static void brwv(struct buf**, int);
+
+// Mark b not busy and wake anyone waiting for it or for a free
+// buffer.  Caller holds bcache.lock.
+static void
+bunbusy(struct buf *b)
+{
+  b->flags &= ~B_BUSY;
+  wakeup(b);
+  if(bcache.waiting){
+    bcache.waiting = 0;
+    wakeup(&bcache.waiting);
+  }
+}
+
+// Map sector of dev to the disk and sector that hold it.
+static void
+bstripemap(uint *dev, uint *sector)
+{
+  uint c;
+
+  if(*dev != ROOTDEV || bcache.stripe == 0)
+    return;
+  c = *sector / bcache.stripe;
+  *dev = (c % 2) ? STRIPEDEV : ROOTDEV;
+  *sector = (c / 2) * bcache.stripe + *sector % bcache.stripe;
+}
+
+// Stripe dev in chunks of chunk sectors, a whole number of
+// blocks, from now on.  Called before any block past the first
+// chunk has been read.
+int
+bstripe(uint dev, uint chunk)
+{
+  if(dev != ROOTDEV || chunk < 2 || chunk % SPB != 0 ||
+     havevirtio || !idedisk(STRIPEDEV))
+    return -1;
+  bcache.stripe = chunk;
+  return 0;
+}
+
 // Look through buffer cache for sector on device dev.
 // If not found, allocate fresh block.
 // In either case, return locked buffer.
@@ -79,9 +162,10 @@ bget(uint dev, uint sector)
     }
   }
 
-  // Allocate fresh block.
+  // Allocate fresh block, preferring the least recently
+  // used clean buffer.
   for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if((b->flags & B_BUSY) == 0){
+    if((b->flags & (B_BUSY|B_DIRTY)) == 0){
       b->dev = dev;
       b->sector = sector;
       b->flags = B_BUSY;
@@ -89,29 +173,249 @@ bget(uint dev, uint sector)
       return b;
     }
   }
-  panic("bget: no buffers");
+
+  // All idle buffers are dirty: write one back and start over,
+  // since the sector may have been cached while we slept.
+  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+    if((b->flags & (B_BUSY|B_LOG)) == 0){
+      bflush1(b);
+      goto loop;
+    }
+  }
+
+  // Every buffer is busy or pinned by the log: wait for one.
+  bcache.waiting = 1;
+  sleep(&bcache.waiting, &bcache.lock);
+  goto loop;
+}
+
+// Write the idle dirty buffer b back to disk.
+// Caller holds bcache.lock, which is released during the write.
+static void
+bflush1(struct buf *b)
+{
+  b->flags |= B_BUSY;
+  release(&bcache.lock);
+  brwv(&b, 1);
+  acquire(&bcache.lock);
+  bcache.ndirty--;
+  bunbusy(b);
+}
+
+// Write back every idle dirty buffer that was dirtied
+// at least age ticks ago, except those pinned by the log.
+// They go to the driver as one batch, sorted by disk position.
+static void
+bflushdirty(uint age)
+{
+  struct buf *b, *bv[NBUF];
+  int i, n;
+
+  acquire(&bcache.lock);
+  n = 0;
+  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+    if((b->flags & (B_BUSY|B_DIRTY|B_LOG)) != B_DIRTY || ticks - b->tick < age)
+      continue;
+    b->flags |= B_BUSY;
+    for(i = n; i > 0; i--){
+      if(bv[i-1]->dev < b->dev ||
+         (bv[i-1]->dev == b->dev && bv[i-1]->sector < b->sector))
+        break;
+      bv[i] = bv[i-1];
+    }
+    bv[i] = b;
+    n++;
+  }
+  release(&bcache.lock);
+  if(n == 0)
+    return;
+
+  brwv(bv, n);
+
+  acquire(&bcache.lock);
+  for(i = 0; i < n; i++)
+    bunbusy(bv[i]);
+  bcache.ndirty -= n;
+  release(&bcache.lock);
+}
+
+// Is b on the virtio disk?  The root file system lives
+// there when QEMU provides one, otherwise on IDE disk 1.
+static int
+bvirtio(struct buf *b)
+{
+  return havevirtio && b->dev == ROOTDEV;
+}
+
+// Read or write the locked buffers bv[0..n-1], as iderw does,
+// and wait for all of them.  Each run of buffers for the same
+// driver is handed over at once so the driver can queue them all.
+static void
+brwv(struct buf **bv, int n)
+{
+  int i, j;
+
+  acquire(&bcache.lock);
+  for(i = 0; i < n; i++){
+    if(bv[i]->flags & B_DIRTY)
+      bcache.nwrite += bv[i]->nsect;
+    else
+      bcache.nread += bv[i]->nsect;
+  }
+  release(&bcache.lock);
+
+  for(i = 0; i < n; i = j){
+    for(j = i+1; j < n && bvirtio(bv[j]) == bvirtio(bv[i]); j++)
+      ;
+    if(bvirtio(bv[i]))
+      virtiorwv(bv+i, j-i);
+    else
+      iderwv(bv+i, j-i);
+  }
 }
 
-// Return a B_BUSY buf with the contents of the indicated disk sector.
+// Return a B_BUSY buf with the contents of the indicated block.
 struct buf*
-bread(uint dev, uint sector)
+bread(uint dev, uint blockno)
 {
   struct buf *b;
+  uint sector;
 
+  sector = blockno * SPB;
+  bstripemap(&dev, &sector);
   b = bget(dev, sector);
+  b->blockno = blockno;
   if(!(b->flags & B_VALID))
-    iderw(b);
+    brwv(&b, 1);
+  return b;
+}
+
+// Return a B_BUSY buf for the indicated block, like bread,
+// but zeroed in memory instead of read from the disk.
+// For a newly allocated block, whose old contents do not matter.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+  uint sector;
+
+  sector = blockno * SPB;
+  bstripemap(&dev, &sector);
+  b = bget(dev, sector);
+  b->blockno = blockno;
+  memset(b->data, 0, BSIZE);
+  b->flags |= B_VALID;
   return b;
 }
 
-// Write b's contents to disk.  Must be locked.
+// Read or write the buffers bv[0..n-1], which are private to
+// the caller rather than in the cache, at the blocks in their
+// dev and blockno fields, and wait.  The caller sets data,
+// nsect (a whole number of blocks), B_BUSY, and B_DIRTY to
+// write.  A buffer of several blocks must not cross a stripe
+// chunk (see bcontig).  Used by the log and the page cache.
+void
+bdirect(struct buf **bv, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(bv[i]->nsect > bcontig(bv[i]->dev, bv[i]->blockno) * SPB)
+      panic("bdirect: crosses chunk");
+    bv[i]->sector = bv[i]->blockno * SPB;
+    bstripemap(&bv[i]->dev, &bv[i]->sector);
+  }
+  brwv(bv, n);
+}
+
+// How many blocks starting at blockno of dev are consecutive
+// on one disk, no more than one request can move (255 sectors).
+uint
+bcontig(uint dev, uint blockno)
+{
+  uint n;
+
+  n = 255;
+  if(dev == ROOTDEV && bcache.stripe)
+    n = bcache.stripe - blockno*SPB % bcache.stripe;
+  if(n > 255)
+    n = 255;
+  return n / SPB;
+}
+
+// The file system has made block blockno of dev part of a file,
+// whose contents the page cache keeps, so forget any copy of it
+// here; written back later, an old copy would overwrite the data.
+// A dirty copy is a metadata block that was freed.
+void
+bforget(uint dev, uint blockno)
+{
+  struct buf *b;
+  uint sector;
+
+  sector = blockno * SPB;
+  bstripemap(&dev, &sector);
+  acquire(&bcache.lock);
+ loop:
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && b->sector == sector){
+      if(b->flags & B_BUSY){
+        sleep(b, &bcache.lock);
+        goto loop;
+      }
+      if(b->flags & B_LOG)
+        panic("bforget: pinned");
+      if(b->flags & B_DIRTY)
+        bcache.ndirty--;
+      b->flags = 0;
+      b->dev = -1;
+      break;
+    }
+  }
+  release(&bcache.lock);
+}
+
+// Mark b's contents as needing to be written to disk.
+// Must be locked.  The write itself happens later.
 void
 bwrite(struct buf *b)
 {
   if((b->flags & B_BUSY) == 0)
     panic("bwrite");
+  if(b->flags & B_DIRTY)
+    return;
+  acquire(&bcache.lock);
   b->flags |= B_DIRTY;
-  iderw(b);
+  b->tick = ticks;
+  bcache.ndirty++;
+  release(&bcache.lock);
+}
+
+// Mark the locked buffer b dirty and keep it in the cache,
+// unwritten, until bunpin.  Called by the log.
+void
+bpin(struct buf *b)
+{
+  if((b->flags & B_BUSY) == 0)
+    panic("bpin");
+  acquire(&bcache.lock);
+  if(!(b->flags & B_DIRTY))
+    bcache.ndirty++;
+  b->flags |= B_DIRTY|B_LOG;
+  b->tick = ticks;
+  release(&bcache.lock);
+}
+
+// The log has committed the locked buffer b: it can be
+// written back like any other dirty buffer.
+void
+bunpin(struct buf *b)
+{
+  if((b->flags & (B_BUSY|B_LOG)) != (B_BUSY|B_LOG))
+    panic("bunpin");
+  acquire(&bcache.lock);
+  b->flags &= ~B_LOG;
+  release(&bcache.lock);
 }
 
 // Release the buffer b.
@@ -130,9 +434,68 @@ brelse(struct buf *b)
   bcache.head.next->prev = b;
   bcache.head.next = b;
 
-  b->flags &= ~B_BUSY;
-  wakeup(b);
+  bunbusy(b);
+
+  release(&bcache.lock);
+}
 
+// Copy the disk traffic counters to st.
+void
+biostat(struct iostat *st)
+{
+  acquire(&bcache.lock);
+  st->nread = bcache.nread;
+  st->nwrite = bcache.nwrite;
   release(&bcache.lock);
 }
 
+// Write all dirty buffers to disk, except those pinned by the
+// log, and wait for them.  A dirty buffer that someone is using
+// or that is being written already is waited for and written
+// after, so on return nothing dirtied earlier is left in memory.
+void
+bsync(void)
+{
+  struct buf *b;
+
+  bflushdirty(0);
+  acquire(&bcache.lock);
+ loop:
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if((b->flags & (B_DIRTY|B_LOG)) != B_DIRTY)
+      continue;
+    if(b->flags & B_BUSY)
+      sleep(b, &bcache.lock);
+    else
+      bflush1(b);
+    goto loop;
+  }
+  release(&bcache.lock);
+}
+
+// Buffer cache flusher, run as a kernel process.
+// Every FLUSHTICKS ticks it commits the log's running transaction
+// and writes back buffers and file pages that have been dirty for
+// FLUSHAGE ticks;
+// if more than half the cache is dirty it writes back everything
+// it can at the next tick.
+void
+bflusher(void)
+{
+  uint last;
+
+  last = ticks;
+  for(;;){
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+    if(bcache.ndirty > NBUF/2)
+      bflushdirty(0);
+    else if(ticks - last >= FLUSHTICKS){
+      log_sync();
+      pcflush(FLUSHAGE);
+      bflushdirty(FLUSHAGE);
+      last = ticks;
+    }
+  }
+}
@@ -2,12 +2,16 @@ struct buf {
   int flags;
   uint dev;
   uint sector;
+  uint blockno;      // block as the file system names it (before striping)
+  uint nsect;        // sectors to transfer, at data; SPB for cache buffers
   struct buf *prev; // LRU cache list
   struct buf *next;
   struct buf *qnext; // disk queue
-  uchar data[512];
+  uint tick;         // when B_DIRTY was set
+  uchar *data;
 };
 #define B_BUSY  0x1  // buffer is locked by some process
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_LOG   0x10 // in the running transaction: not to be written home yet
 
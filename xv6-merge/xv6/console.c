@@ -9,6 +9,7 @@
 #include "spinlock.h"
 #include "fs.h"
 #include "file.h"
+#include "fcntl.h"
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
@@ -210,6 +211,7 @@ consoleintr(int (*getc)(void))
         if(c == '\n' || c == C('D') || input.e == input.r+INPUT_BUF){
           input.w = input.e;
           wakeup(&input.r);
+          pollwakeup();
         }
       }
       break;
@@ -271,6 +273,20 @@ consolewrite(struct inode *ip, char *buf, int n)
   return n;
 }
 
+// A line is ready to read; output never waits.
+int
+consolepoll(struct inode *ip)
+{
+  int r;
+
+  r = POLLOUT;
+  acquire(&input.lock);
+  if(input.r != input.w)
+    r |= POLLIN;
+  release(&input.lock);
+  return r;
+}
+
 void
 consoleinit(void)
 {
@@ -279,6 +295,7 @@ consoleinit(void)
 
   devsw[CONSOLE].write = consolewrite;
   devsw[CONSOLE].read = consoleread;
+  devsw[CONSOLE].poll = consolepoll;
   cons.locking = 1;
 
   picenable(IRQ_KBD);
@@ -62,11 +62,14 @@ int main(int argc, char *argv[])
 		exit();
 	}
 	
-	//复制文件
+	//复制文件：在内核中复制，不支持时（如设备文件）用read/write
 	char buf[BUF_SIZE] = {};
 	int len = 0;
-	while((len = read(fd_src, buf, BUF_SIZE)) > 0)
-		write(fd_dest, buf, len);
+	while((len = copy_file_range(fd_src, fd_dest, 1<<20)) > 0)
+		;
+	if(len < 0)
+		while((len = read(fd_src, buf, BUF_SIZE)) > 0)
+			write(fd_dest, buf, len);
 	
 	//关闭文件和程序
 	close(fd_src);
@@ -96,7 +99,7 @@ void ls(char *path)
 {
 	char buf[512], *p;
 	int fd;
-	struct dirent de;
+	uint inum;
 	struct stat st;
 	
 	if((fd = open(path, 0)) < 0)
@@ -119,7 +122,7 @@ void ls(char *path)
 		break;
 		
 		case T_DIR:
-		if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf)
+		if(strlen(path) + 1 + MAXNAME + 1 > sizeof buf)
 		{
 			printf(1, "path too long\n");
 			break;
@@ -128,12 +131,8 @@ void ls(char *path)
 		p = buf+strlen(buf);
 		*p++ = '/';
 		
-		while(read(fd, &de, sizeof(de)) == sizeof(de))
+		while(readdir(fd, &inum, p))
 		{
-			if(de.inum == 0)
-				continue;
-			memmove(p, de.name, DIRSIZ);
-			p[DIRSIZ] = 0;
 			if(stat(buf, &st) < 0)
 			{
 				printf(1, "cannot stat %s\n", buf);
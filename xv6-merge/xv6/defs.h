@@ -3,18 +3,32 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct iostat;
+struct page;
 struct pipe;
 struct proc;
 struct spinlock;
 struct stat;
+struct superblock;
 struct Window;
 struct Node;
 
 // bio.c
+uint            bcontig(uint, uint);
+void            bdirect(struct buf**, int);
+void            bforget(uint, uint);
 void            binit(void);
+void            biostat(struct iostat*);
+struct buf*     bnew(uint, uint);
+void            bpin(struct buf*);
 struct buf*     bread(uint, uint);
+int             bstripe(uint, uint);
 void            brelse(struct buf*);
+void            bunpin(struct buf*);
 void            bwrite(struct buf*);
+void            bsync(void);
+void            bflusher(void) __attribute__((noreturn));
 
 // console.c
 void            consoleinit(void);
@@ -26,26 +40,55 @@ void            panic(char*) __attribute__((noreturn));
 int             exec(char*, char**);
 
 // file.c
+int             fdalloc(struct file*);
+struct file*    fdclear(int);
+void            fdcloseall(void);
+int             fdfork(struct proc*);
+struct file*    fdget(int);
+void            fdinit(struct proc*);
 struct file*    filealloc(void);
 void            fileclose(struct file*);
+int             filecopy(struct file*, struct file*, int);
 struct file*    filedup(struct file*);
 void            fileinit(void);
+int             filelimit(int);
+int             filepoll(struct file*);
+int             filepread(struct file*, char*, int n, uint);
+int             filepwrite(struct file*, char*, int n, uint);
 int             fileread(struct file*, char*, int n);
+int             filereadv(struct file*, struct iovec*, int);
+int             fileseek(struct file*, int, int);
+int             filesplice(struct file*, struct file*, int);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filewritev(struct file*, struct iovec*, int);
+void            pollsleep(uint, int, uint);
+uint            pollstart(void);
+void            pollstop(void);
+void            polltick(void);
+void            pollwakeup(void);
 
 //folder.c
 void 			InitFolder(struct Window*);
 void 			Folder(struct Window*, int, int, int);
 
 // fs.c
+void            bfreecommit(void);
+int             bfreelow(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+int             dirread(struct inode*, uint*, char*, uint);
+int             dirrename(struct inode*, char*, struct inode*, char*);
+void            dirunlink(struct inode*, uint);
+void            fsinit(int);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
+char*           igetpage(struct inode*, uint, uint*);
 void            iinit(void);
 void            ilock(struct inode*);
 void            iput(struct inode*);
+int             iputpage(struct inode*, char*, uint);
+int             isdirempty(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
@@ -57,12 +100,17 @@ void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
 // ide.c
+int             idedisk(int);
 void            ideinit(void);
-void            ideintr(void);
+void            ideintr(int);
 void            iderw(struct buf*);
+void            iderwv(struct buf**, int);
 
 // pci.c
+int             pcifind(ushort, ushort, uchar*, uchar*, uchar*);
+uint            read_pci_config(uchar, uchar, uchar, uchar);
 void            soundinit(void);
+void            write_pci_config(uchar, uchar, uchar, uchar, uint);
 
 // audio.c
 void            soundcardinit(uchar, uchar, uchar);
@@ -74,10 +122,18 @@ void            ioapicenable(int irq, int cpu);
 extern uchar    ioapicid;
 void            ioapicinit(void);
 
+// ioring.c
+void            ioringfree(void);
+void            ioringinit(void);
+void            ioringpause(void);
+void            ioringresume(void);
+
 // kalloc.c
 char*           kalloc(void);
+void            kdup(char*);
 void            kfree(char*);
 void            kinit();
+int             kref(char*);
 
 // kbd.c
 void            kbdintr(void);
@@ -94,6 +150,13 @@ void            lapicinit(int);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
+// log.c
+void            begin_op(void);
+void            end_op(void);
+void            initlog(int, struct superblock*);
+void            log_sync(void);
+void            log_write(struct buf*);
+
 // mp.c
 extern int      ismp;
 int             mpbcpu(void);
@@ -104,11 +167,37 @@ void            mpstartthem(void);
 void            picenable(int);
 void            picinit(void);
 
+// virtio.c
+extern int      havevirtio;
+extern int      virtioirq;
+void            virtioinit(void);
+int             virtiointr(void);
+void            virtiorwv(struct buf**, int);
+
+// pcache.c
+void            pcflush(uint);
+void            pcinit(void);
+void            pcinval(uint, uint);
+int             pcreclaim(void);
+void            pcstat(struct iostat*);
+void            pcsync(void);
+void            pdirty(struct page*, uint);
+struct page*    pget(uint, uint, uint);
+int             pown(struct page*);
+void            pread(struct page**, int);
+void            prelse(struct page*);
+char*           pswap(struct page*, char*);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, char*, int);
-int             pipewrite(struct pipe*, char*, int);
+int             pipegetpage(struct pipe*, char**, uint*, uint, int);
+int             pipepoll(struct pipe*, int);
+void            pipeputback(struct pipe*, char*, uint, uint);
+int             pipeputpage(struct pipe*, char*, uint, uint);
+int             piperead(struct pipe*, char*, int, int);
+int             pipereserve(struct pipe*, int);
+int             pipewrite(struct pipe*, char*, int, int);
 
 // proc.c
 struct proc*    copyproc(struct proc*);
@@ -116,6 +205,7 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+void            kproc(char*, void(*)(void));
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
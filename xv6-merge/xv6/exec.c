@@ -20,8 +20,11 @@ exec(char *path, char **argv)
   pgdir = 0;
   sz = 0;
 
-  if((ip = namei(path)) == 0)
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
     return -1;
+  }
   ilock(ip);
 
   // Check ELF header
@@ -47,6 +50,8 @@ exec(char *path, char **argv)
       goto bad;
   }
   iunlockput(ip);
+  end_op();
+  ip = 0;
 
   // Allocate and initialize stack at sz
   sz = spbottom = PGROUNDUP(sz);
@@ -87,6 +92,7 @@ exec(char *path, char **argv)
   safestrcpy(proc->name, last, sizeof(proc->name));
 
   // Commit to the user image.
+  ioringfree();
   oldpgdir = proc->pgdir;
   proc->pgdir = pgdir;
   proc->sz = sz;
@@ -101,6 +107,9 @@ exec(char *path, char **argv)
 
  bad:
   if(pgdir) freevm(pgdir);
-  iunlockput(ip);
+  if(ip){
+    iunlockput(ip);
+    end_op();
+  }
   return -1;
 }
@@ -2,3 +2,37 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+#define O_NONBLOCK 0x800  // read and write return -1 instead of waiting
+
+// fcntl commands.
+#define F_GETFL   3   // return the O_ flags of a file
+#define F_SETFL   4   // set O_NONBLOCK of a file from the argument
+
+// Resources for ulimit.
+#define RLIMIT_NOFILE 0   // files the process may have open, up to NOFILEMAX
+#define RLIMIT_NFILE  1   // files open in the whole system
+
+// Events for poll.  POLLHUP, POLLERR and POLLNVAL are reported
+// whether or not they were asked for.
+#define POLLIN    0x001   // read will not wait
+#define POLLOUT   0x004   // write will not wait
+#define POLLERR   0x008   // write end of a pipe with no reader
+#define POLLHUP   0x010   // read end of a pipe with no writer
+#define POLLNVAL  0x020   // fd is not open
+
+struct pollfd {
+  int fd;         // file descriptor, or negative to skip
+  short events;   // what to wait for
+  short revents;  // what happened
+};
+
+// lseek whence.
+#define SEEK_SET  0   // offset from the start of the file
+#define SEEK_CUR  1   // from the current offset
+#define SEEK_END  2   // from the end of the file
+
+// A segment of memory for readv and writev.
+struct iovec {
+  void *iov_base;
+  int iov_len;
+};
@@ -1,38 +1,138 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "fs.h"
+#include "stat.h"
 #include "file.h"
+#include "fcntl.h"
 #include "spinlock.h"
+#include "x86.h"
 
 struct devsw devsw[NDEV];
+
+// Files come from slabs, pages of kalloc'd memory each holding
+// an fslab followed by FPERSLAB files.  Each slab keeps a list
+// of its free files, and ftable a list of the slabs that have
+// any, so filealloc and fileclose take constant time.  A slab
+// none of whose files is open goes back to kalloc, unless it is
+// the only one.  At most ftable.max files are open at once.
+struct fslab {
+  struct fslab *next;   // next slab with free files
+  struct file *free;    // free files of this slab
+  int nused;            // files in use
+};
+
+#define FPERSLAB ((PGSIZE - sizeof(struct fslab)) / sizeof(struct file))
+
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct fslab *partial;  // slabs with free files
+  int nslab;
+  int nfile;              // files in use
+  int max;
 } ftable;
 
+// A process in poll sleeps on pollq.seq until anything that may
+// have made a file ready calls pollwakeup, which counts and wakes
+// it.  The poller reads the count before it looks at its files,
+// and sleeps only if it has not changed since, so it cannot miss
+// a change; pollwakeup does nothing while no one is polling.
+struct {
+  struct spinlock lock;
+  uint seq;     // calls to pollwakeup while someone polls
+  int npoll;    // processes in poll
+  int ntimed;   // of those, asleep with a timeout
+} pollq;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.max = NFILE;
+  initlock(&pollq.lock, "pollq");
 }
 
 // Allocate a file structure.
 struct file*
 filealloc(void)
 {
+  struct fslab *s;
   struct file *f;
+  char *mem;
 
   acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
+  while(ftable.partial == 0 && ftable.nfile < ftable.max){
+    release(&ftable.lock);
+    if((mem = kalloc()) == 0)
+      return 0;
+    memset(mem, 0, PGSIZE);
+    s = (struct fslab*)mem;
+    for(f = (struct file*)(s + 1); f < (struct file*)(s + 1) + FPERSLAB; f++){
+      f->next = s->free;
+      s->free = f;
     }
+    acquire(&ftable.lock);
+    s->next = ftable.partial;
+    ftable.partial = s;
+    ftable.nslab++;
+  }
+  if(ftable.nfile >= ftable.max){
+    release(&ftable.lock);
+    return 0;
   }
+  s = ftable.partial;
+  f = s->free;
+  s->free = f->next;
+  if(s->free == 0)
+    ftable.partial = s->next;
+  s->nused++;
+  ftable.nfile++;
+  f->ref = 1;
   release(&ftable.lock);
-  return 0;
+  return f;
+}
+
+// Put f, which is no longer open, back in its slab, and return
+// the slab if it should go back to kalloc.
+// Caller holds ftable.lock.
+static struct fslab*
+filefree(struct file *f)
+{
+  struct fslab *s, **sp;
+
+  s = (struct fslab*)PGROUNDDOWN(f);
+  if(s->free == 0){
+    s->next = ftable.partial;
+    ftable.partial = s;
+  }
+  f->next = s->free;
+  s->free = f;
+  s->nused--;
+  ftable.nfile--;
+  if(s->nused > 0 || ftable.nslab == 1)
+    return 0;
+  for(sp = &ftable.partial; *sp != s; sp = &(*sp)->next)
+    ;
+  *sp = s->next;
+  ftable.nslab--;
+  return s;
+}
+
+// Return the most files that may be open at once, and
+// set it to n if n is not negative.
+int
+filelimit(int n)
+{
+  int old;
+
+  acquire(&ftable.lock);
+  old = ftable.max;
+  if(n >= 0)
+    ftable.max = n;
+  release(&ftable.lock);
+  return old;
 }
 
 // Increment ref count for file f.
@@ -52,6 +152,7 @@ void
 fileclose(struct file *f)
 {
   struct file ff;
+  struct fslab *s;
 
   acquire(&ftable.lock);
   if(f->ref < 1)
@@ -63,12 +164,18 @@ fileclose(struct file *f)
   ff = *f;
   f->ref = 0;
   f->type = FD_NONE;
+  s = filefree(f);
   release(&ftable.lock);
+  if(s)
+    kfree((char*)s);
   
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
-  else if(ff.type == FD_INODE)
+  else if(ff.type == FD_INODE){
+    begin_op();
     iput(ff.ip);
+    end_op();
+  }
 }
 
 // Get metadata about file f.
@@ -84,22 +191,299 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// Set up the descriptor table of new process p, with no files.
+void
+fdinit(struct proc *p)
+{
+  struct fdtable *t;
+
+  t = &p->fdt;
+  memset(t, 0, sizeof(*t));
+  t->ofile = t->small;
+  t->size = NOFILE;
+  t->max = NOFILEMAX;
+}
+
+// Return the file open as fd in the current process, or 0.
+struct file*
+fdget(int fd)
+{
+  struct fdtable *t;
+
+  t = &proc->fdt;
+  if(fd < 0 || fd >= t->size)
+    return 0;
+  return t->ofile[fd];
+}
+
+// Open f as the lowest free fd of the current process, and
+// return the fd.  Takes over the caller's reference to f.
+int
+fdalloc(struct file *f)
+{
+  struct fdtable *t;
+  struct file **ofile;
+  int i, fd;
+
+  t = &proc->fdt;
+  if(t->full == ~0)
+    return -1;
+  i = bsf(~t->full);
+  fd = i*32 + bsf(~t->used[i]);
+  if(fd >= t->max)
+    return -1;
+  if(fd >= t->size){
+    if((ofile = (struct file**)kalloc()) == 0)
+      return -1;
+    memset(ofile, 0, PGSIZE);
+    memmove(ofile, t->ofile, t->size * sizeof(*ofile));
+    t->ofile = ofile;
+    t->size = NOFILEMAX;
+  }
+  t->ofile[fd] = f;
+  t->used[i] |= 1U << (fd % 32);
+  if(t->used[i] == ~0)
+    t->full |= 1U << i;
+  return fd;
+}
+
+// Take fd out of the current process's table, and return
+// the file that was open as it, or 0.
+struct file*
+fdclear(int fd)
+{
+  struct fdtable *t;
+  struct file *f;
+
+  t = &proc->fdt;
+  if((f = fdget(fd)) == 0)
+    return 0;
+  t->ofile[fd] = 0;
+  t->used[fd / 32] &= ~(1U << (fd % 32));
+  t->full &= ~(1U << (fd / 32));
+  return f;
+}
+
+// Give np, a child of the current process, the same open
+// files and limit.  Returns -1 if there is no memory.
+int
+fdfork(struct proc *np)
+{
+  struct fdtable *t, *nt;
+  int fd;
+
+  t = &proc->fdt;
+  nt = &np->fdt;
+  for(fd = NOFILE; fd < t->size; fd++)
+    if(t->ofile[fd])
+      break;
+  if(fd < t->size){
+    if((nt->ofile = (struct file**)kalloc()) == 0){
+      nt->ofile = nt->small;
+      return -1;
+    }
+    memset(nt->ofile, 0, PGSIZE);
+    nt->size = NOFILEMAX;
+  }
+  for(fd = 0; fd < t->size; fd++)
+    if(t->ofile[fd])
+      nt->ofile[fd] = filedup(t->ofile[fd]);
+  nt->max = t->max;
+  nt->full = t->full;
+  memmove(nt->used, t->used, sizeof(t->used));
+  return 0;
+}
+
+// Close all files of the current process, and give
+// back its table's memory.
+void
+fdcloseall(void)
+{
+  struct fdtable *t;
+  int fd;
+
+  t = &proc->fdt;
+  for(fd = 0; fd < t->size; fd++)
+    if(t->ofile[fd])
+      fileclose(fdclear(fd));
+  if(t->ofile != t->small){
+    kfree((char*)t->ofile);
+    memset(t->small, 0, sizeof(t->small));
+  }
+  t->ofile = t->small;
+  t->size = NOFILE;
+}
+
+// Which of the events for poll hold for file f now?
+// A device without a poll routine is always ready.
+int
+filepoll(struct file *f)
+{
+  int r;
+
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->writable);
+  r = POLLIN | POLLOUT;
+  if(f->type == FD_INODE){
+    ilock(f->ip);
+    if(f->ip->type == T_DEV && f->ip->major >= 0 && f->ip->major < NDEV &&
+       devsw[f->ip->major].poll)
+      r = devsw[f->ip->major].poll(f->ip);
+    iunlock(f->ip);
+  }
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r;
+}
+
+// Something may have made a file ready: wake pollers.
+void
+pollwakeup(void)
+{
+  if(pollq.npoll == 0)
+    return;
+  acquire(&pollq.lock);
+  pollq.seq++;
+  wakeup(&pollq.seq);
+  release(&pollq.lock);
+}
+
+// The clock ticked: wake pollers waiting for a timeout.
+void
+polltick(void)
+{
+  if(pollq.ntimed == 0)
+    return;
+  acquire(&pollq.lock);
+  wakeup(&pollq.seq);
+  release(&pollq.lock);
+}
+
+// Start looking at files for poll; returns the count to
+// pass to pollsleep.  Call pollstop when done.
+uint
+pollstart(void)
+{
+  uint seq;
+
+  acquire(&pollq.lock);
+  pollq.npoll++;
+  seq = pollq.seq;
+  release(&pollq.lock);
+  return seq;
+}
+
+void
+pollstop(void)
+{
+  acquire(&pollq.lock);
+  pollq.npoll--;
+  release(&pollq.lock);
+}
+
+// Sleep until pollwakeup has been called since pollstart
+// returned seq, until ticks reaches deadline if timed, or
+// until the process is killed.
+void
+pollsleep(uint seq, int timed, uint deadline)
+{
+  acquire(&pollq.lock);
+  if(timed)
+    pollq.ntimed++;
+  while(pollq.seq == seq && !proc->killed && !(timed && (int)(ticks - deadline) >= 0))
+    sleep(&pollq.seq, &pollq.lock);
+  if(timed)
+    pollq.ntimed--;
+  release(&pollq.lock);
+}
+
+// Read into the cnt segments of iov in turn from inode file f
+// at *off, advancing it, with f->ip locked once for all of them.
+// Stops at a short read.
+static int
+inoderead(struct file *f, struct iovec *iov, int cnt, uint *off)
+{
+  int i, r, tot;
+
+  if(f->nonblock && !(filepoll(f) & POLLIN))
+    return -1;
+  r = tot = 0;
+  ilock(f->ip);
+  for(i = 0; i < cnt; i++){
+    if((r = readi(f->ip, iov[i].iov_base, *off, iov[i].iov_len)) > 0){
+      *off += r;
+      tot += r;
+    }
+    if(r != iov[i].iov_len)
+      break;
+  }
+  iunlock(f->ip);
+  return (tot == 0 && r < 0) ? -1 : tot;
+}
+
+// Write the cnt segments of iov in turn to inode file f at
+// *off, advancing it.  Stops at a short write.
+static int
+inodewrite(struct file *f, struct iovec *iov, int cnt, uint *off)
+{
+  int i, r, tot, n, m, room, inop;
+  char *p;
+
+  if(f->nonblock && !(filepoll(f) & POLLOUT))
+    return -1;
+  // Write a few blocks per transaction, so that one transaction
+  // need not hold the bitmap and extent blocks of a huge
+  // write: besides the inode, a chunk of 32 blocks dirties
+  // at most two extent blocks and a few bitmap blocks.
+  // Small segments share a transaction.
+  r = tot = room = inop = 0;
+  for(i = 0; i < cnt; i++){
+    p = iov[i].iov_base;
+    for(n = iov[i].iov_len; n > 0; n -= r, p += r){
+      if(room == 0){
+        if(inop){
+          iunlock(f->ip);
+          end_op();
+        }
+        begin_op();
+        ilock(f->ip);
+        inop = 1;
+        room = 32*BSIZE;
+      }
+      m = n < room ? n : room;
+      if((r = writei(f->ip, p, *off, m)) > 0){
+        *off += r;
+        tot += r;
+        room -= r;
+      }
+      if(r != m)
+        goto out;
+    }
+  }
+ out:
+  if(inop){
+    iunlock(f->ip);
+    end_op();
+  }
+  return (tot == 0 && r < 0) ? -1 : tot;
+}
+
 // Read from file f.  Addr is kernel address.
 int
 fileread(struct file *f, char *addr, int n)
 {
-  int r;
+  struct iovec iov;
 
   if(f->readable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return piperead(f->pipe, addr, n);
+    return piperead(f->pipe, addr, n, f->nonblock);
   if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
-    return r;
+    iov.iov_base = addr;
+    iov.iov_len = n;
+    return inoderead(f, &iov, 1, &f->off);
   }
   panic("fileread");
 }
@@ -108,19 +492,326 @@ fileread(struct file *f, char *addr, int n)
 int
 filewrite(struct file *f, char *addr, int n)
 {
-  int r;
+  struct iovec iov;
 
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return pipewrite(f->pipe, addr, n);
+    return pipewrite(f->pipe, addr, n, f->nonblock);
   if(f->type == FD_INODE){
+    iov.iov_base = addr;
+    iov.iov_len = n;
+    return inodewrite(f, &iov, 1, &f->off);
+  }
+  panic("filewrite");
+}
+
+// Read from file f at offset off, leaving its offset alone.
+// Pipes have no offset.
+int
+filepread(struct file *f, char *addr, int n, uint off)
+{
+  struct iovec iov;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  iov.iov_base = addr;
+  iov.iov_len = n;
+  return inoderead(f, &iov, 1, &off);
+}
+
+// Write to file f at offset off, leaving its offset alone.
+int
+filepwrite(struct file *f, char *addr, int n, uint off)
+{
+  struct iovec iov;
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  iov.iov_base = addr;
+  iov.iov_len = n;
+  return inodewrite(f, &iov, 1, &off);
+}
+
+// Read from file f into the cnt segments of iov in turn, as
+// one read: a pipe is waited for only until some bytes come,
+// as for read.  Addresses are kernel addresses.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r, tot;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type == FD_INODE)
+    return inoderead(f, iov, cnt, &f->off);
+  if(f->type == FD_PIPE){
+    r = tot = 0;
+    for(i = 0; i < cnt; i++){
+      r = piperead(f->pipe, iov[i].iov_base, iov[i].iov_len, f->nonblock || tot > 0);
+      if(r > 0)
+        tot += r;
+      if(r != iov[i].iov_len)
+        break;
+    }
+    return (tot == 0 && r < 0) ? -1 : tot;
+  }
+  panic("filereadv");
+}
+
+// Write the cnt segments of iov in turn to file f, as one
+// write.  Addresses are kernel addresses.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r, tot;
+
+  if(f->writable == 0)
+    return -1;
+  if(f->type == FD_INODE)
+    return inodewrite(f, iov, cnt, &f->off);
+  if(f->type == FD_PIPE){
+    r = tot = 0;
+    for(i = 0; i < cnt; i++){
+      r = pipewrite(f->pipe, iov[i].iov_base, iov[i].iov_len, f->nonblock);
+      if(r > 0)
+        tot += r;
+      if(r != iov[i].iov_len)
+        break;
+    }
+    return (tot == 0 && r < 0) ? -1 : tot;
+  }
+  panic("filewritev");
+}
+
+// Set the offset of file f to off from whence, and return
+// it.  Files have no holes, so the offset cannot pass the end.
+// Pipes have no offset.
+int
+fileseek(struct file *f, int off, int whence)
+{
+  if(f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  switch(whence){
+  case SEEK_SET:
+    break;
+  case SEEK_CUR:
+    off += f->off;
+    break;
+  case SEEK_END:
+    off += f->ip->size;
+    break;
+  default:
+    off = -1;
+  }
+  if(off < 0 || off > f->ip->size)
+    off = -1;
+  else
+    f->off = off;
+  iunlock(f->ip);
+  return off;
+}
+
+// Write the n bytes at off in mem, a page of memory the caller
+// owns, to file f.  A whole page going to a page boundary of a
+// file becomes the file's page without being copied, if no one
+// else owns it.  Returns bytes written, or -1; mem is the
+// caller's to free only if *kept is set.
+static int
+filewritepage(struct file *f, char *mem, uint off, uint n, int *kept)
+{
+  int r;
+
+  *kept = 1;
+  if(f->type == FD_INODE && off == 0 && n == PGSIZE &&
+     f->off % PGSIZE == 0 && kref(mem) == 1){
+    begin_op();
     ilock(f->ip);
-    if((r = writei(f->ip, addr, f->off, n)) > 0)
+    if((r = iputpage(f->ip, mem, f->off)) > 0)
       f->off += r;
     iunlock(f->ip);
-    return r;
+    end_op();
+    if(r > 0){
+      *kept = 0;
+      return r;
+    }
   }
-  panic("filewrite");
+  return filewrite(f, mem + off, n);
 }
 
+// Move up to n bytes from in to out, at least one of which is
+// a pipe, without copying them to user space.  Pages move
+// between pipes, and between a pipe and the page cache, by
+// reference; other data is copied in the kernel.  Like read,
+// it waits only for the first bytes from a pipe, and what it
+// takes from one but cannot write goes back.  It keeps room in
+// a pipe it writes to before taking the data, and like write
+// waits for room only for the first bytes, and not at all if
+// the pipe is O_NONBLOCK.  Returns the
+// number of bytes moved, 0 at end of file, or -1.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  char *mem;
+  uint off, m;
+  int tot, r, w, kept;
+
+  r = 0;
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type != FD_PIPE && out->type != FD_PIPE)
+    return -1;
+  for(tot = 0; tot < n; tot += r){
+    if(in->type == FD_PIPE){
+      if(out->type == FD_PIPE && pipereserve(out->pipe, out->nonblock || tot > 0) < 0){
+        r = -1;
+        break;
+      }
+      r = pipegetpage(in->pipe, &mem, &off, n - tot, in->nonblock || tot > 0);
+      if(r <= 0){
+        if(out->type == FD_PIPE)
+          pipeputpage(out->pipe, 0, 0, 0);
+        break;
+      }
+      if(out->type == FD_PIPE){
+        if(pipeputpage(out->pipe, mem, off, r) < 0){
+          pipeputback(in->pipe, mem, off, r);
+          r = -1;
+          break;
+        }
+        pipeputback(in->pipe, 0, 0, 0);
+        continue;
+      }
+      m = r;
+      r = filewritepage(out, mem, off, m, &kept);
+      w = r < 0 ? 0 : r;
+      if(kept && w < m)
+        pipeputback(in->pipe, mem, off + w, m - w);
+      else {
+        pipeputback(in->pipe, 0, 0, 0);
+        if(kept)
+          kfree(mem);
+      }
+      if(r < 0)
+        break;
+      if(r < m){
+        tot += r;
+        break;
+      }
+      continue;
+    }
+
+    // A file into a pipe.
+    if(pipereserve(out->pipe, out->nonblock || tot > 0) < 0){
+      r = -1;
+      break;
+    }
+    mem = 0;
+    if(in->type == FD_INODE){
+      ilock(in->ip);
+      if((mem = igetpage(in->ip, in->off, &m)) != 0){
+        off = in->off % PGSIZE;
+        if(m > n - tot)
+          m = n - tot;
+        in->off += m;
+      }
+      iunlock(in->ip);
+    }
+    if(mem == 0){
+      if((mem = kalloc()) == 0){
+        pipeputpage(out->pipe, 0, 0, 0);
+        r = -1;
+        break;
+      }
+      off = 0;
+      if((r = fileread(in, mem, n - tot < PGSIZE ? n - tot : PGSIZE)) <= 0){
+        pipeputpage(out->pipe, 0, 0, 0);
+        kfree(mem);
+        break;
+      }
+      m = r;
+    }
+    if(pipeputpage(out->pipe, mem, off, m) < 0){
+      kfree(mem);
+      r = -1;
+      break;
+    }
+    r = m;
+  }
+  return tot > 0 ? tot : r;
+}
+
+// Copy up to n bytes from file in to file out, from and to
+// their offsets, inside the kernel.  Reading in sequentially
+// gets its pages read ahead (see pgetfile in fs.c).  Where both
+// offsets are page aligned, a whole page is not copied: out's
+// page cache shares in's page, and whichever file is written
+// first gets a copy of it (see pown in pcache.c).  Returns the
+// number of bytes copied, 0 at end of file, or -1.
+int
+filecopy(struct file *in, struct file *out, int n)
+{
+  char *mem, *buf;
+  uint m;
+  int tot, r, w;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type != FD_INODE || out->type != FD_INODE)
+    return -1;
+  buf = 0;
+  r = 0;
+  for(tot = 0; tot < n; tot += w){
+    mem = 0;
+    ilock(in->ip);
+    if(in->ip->type == T_DIR){
+      iunlock(in->ip);
+      r = -1;
+      break;
+    }
+    if(in->off % PGSIZE == 0 && out->off % PGSIZE == 0 && n - tot >= PGSIZE &&
+       (mem = igetpage(in->ip, in->off, &m)) != 0 && m < PGSIZE){
+      kfree(mem);
+      mem = 0;
+    }
+    if(mem)
+      r = PGSIZE;
+    else if(buf || (buf = kalloc()) != 0)
+      r = readi(in->ip, buf, in->off, n - tot < PGSIZE ? n - tot : PGSIZE);
+    else
+      r = -1;
+    if(r > 0)
+      in->off += r;
+    iunlock(in->ip);
+    if(r <= 0)
+      break;
+
+    begin_op();
+    ilock(out->ip);
+    if(mem){
+      kdup(mem);
+      if((w = iputpage(out->ip, mem, out->off)) < 0){
+        kfree(mem);
+        w = writei(out->ip, mem, out->off, PGSIZE);
+      }
+      kfree(mem);
+    } else
+      w = writei(out->ip, buf, out->off, r);
+    if(w > 0)
+      out->off += w;
+    iunlock(out->ip);
+    end_op();
+    if(w < r){
+      if(w < 0)
+        w = 0;
+      in->off -= r - w;
+      tot += w;
+      r = -1;
+      break;
+    }
+  }
+  if(buf)
+    kfree(buf);
+  return tot > 0 ? tot : r;
+}
@@ -3,9 +3,11 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;  // O_NONBLOCK
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  struct file *next;  // free list of its slab (see file.c)
 };
 
 
@@ -16,13 +18,25 @@ struct inode {
   uint inum;          // Inode number
   int ref;            // Reference count
   int flags;          // I_BUSY, I_VALID
+  struct inode *hnext;  // hash chain or free list
+  struct inode *prev;   // LRU list, while ref is 0
+  struct inode *next;
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  struct extent ext[NEXTENT];
+  uint extblk;
+  uchar inl[NINLINE];
+
+  struct {            // extent last looked up by bmap
+    uint lblk;        // first file block it maps
+    uint start;
+    uint len;         // 0 if none
+  } ec;
+  uint ra;            // page a sequential reader reads next
 };
 
 #define I_BUSY 0x1
@@ -34,6 +48,7 @@ struct inode {
 struct devsw {
   int (*read)(struct inode*, char*, int);
   int (*write)(struct inode*, char*, int);
+  int (*poll)(struct inode*);  // which of POLLIN, POLLOUT hold now
 };
 
 extern struct devsw devsw[];
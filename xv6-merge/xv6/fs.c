@@ -4,11 +4,18 @@
 //   + Directories: inode with special contents (list of other inodes!)
 //   + Names: paths like /usr/rtm/xv6/fs.c for convenient naming.
 //
-// Disk layout is: superblock, inodes, block in-use bitmap, data blocks.
+// Disk layout is: superblock, inodes, block in-use bitmap, log,
+// data blocks.
 //
 // This file contains the low-level file system manipulation 
 // routines.  The (higher-level) system call implementations
 // are in sysfile.c.
+//
+// Metadata blocks are written with log_write, so the routines
+// that change the file system must be called inside a
+// transaction (begin_op/end_op, see log.c).  The contents of
+// regular files live in the page cache (pcache.c), and those
+// of directories in the buffer cache.
 
 #include "types.h"
 #include "defs.h"
@@ -20,9 +27,13 @@
 #include "buf.h"
 #include "fs.h"
 #include "file.h"
+#include "page.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void dcinit(void);
+static void dcpurge(uint, uint);
+static uint dirlookup1(struct inode*, char*, uint*);
 
 // Read the super block.
 static void
@@ -35,66 +46,334 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
-// Zero a block.
+// Blocks. 
+//
+// The superblock of the root file system is read once, by
+// fsinit, and kept in fscache.  So is a summary of the block
+// bitmap, the number of free blocks each bitmap block describes,
+// which lets balloc skip full bitmap blocks without reading them.
+// fsinit also builds a bitmap of the inodes in use, which
+// ialloc and ifree keep up to date (see Inodes below).
+//
+// Blocks are placed for locality.  The disk is split into
+// allocation groups of AGBMAP bitmap blocks, at least 64 MB, and the
+// inodes into as many groups: ialloc puts a file's inode in
+// its directory's group and a new directory in the group with
+// the most free blocks, and a file's first block goes at the
+// start of its inode's group.  Each later block goes right
+// after the one before it if that is free.  A file being
+// written also gets a preallocation window: the next PREALLOC
+// blocks after its last one are reserved in memory (not on
+// disk), and other files allocate outside them unless the disk
+// has nothing else, so files written at the same time do not
+// interleave their blocks.  A window goes away when the file
+// is no longer open.
+//
+// With a log, blocks that bfree frees are not counted in
+// nfree until the transaction that frees them has committed,
+// and until then balloc passes over them: otherwise a block
+// could be given to another file and written before a crash
+// brought back the one it came from.  bfree marks them in a
+// page per bitmap block, pend; if it has no memory for one,
+// balloc leaves that whole bitmap block alone until the commit.
+// begin_op commits first when frees are waiting and few blocks
+// are free otherwise (see bfreelow).
+
+struct {
+  struct spinlock lock;
+  uint dev;
+  struct superblock sb;
+  uint nbmap;       // number of bitmap blocks
+  ushort *nfree;    // free blocks described by each bitmap block
+  ushort *npend;    // blocks freed there since the last commit
+  uchar **pend;     // those blocks, one bit each, or 0
+  uchar *imap;      // inodes in use, one bit each
+  uint ihint;       // no free inode below this one
+  uint ngroup;      // allocation groups
+  uint ipg;         // inodes per group
+  struct {
+    uint inum;      // file it is for, 0 if unused
+    uint start;     // first reserved block
+    uint end;       // block after the last reserved one
+  } win[NPREALLOC]; // preallocation windows
+  uint winhand;     // window to reuse next
+} fscache;
+
+#define AGBMAP ((64*1024*1024/BSIZE + BPB-1) / BPB)  // bitmap blocks per group
+
+// Allocation group of inode inum.
+static uint
+agofinode(uint inum)
+{
+  return inum / fscache.ipg;
+}
+
+// First block of allocation group g.
+static uint
+agstart(uint g)
+{
+  return g * AGBMAP * BPB;
+}
+
+// Free blocks in allocation group g.  Caller holds fscache.lock.
+static uint
+agfree(uint g)
+{
+  uint i, n;
+
+  n = 0;
+  for(i = g*AGBMAP; i < (g+1)*AGBMAP && i < fscache.nbmap; i++)
+    n += fscache.nfree[i];
+  return n;
+}
+
+// Is block b in the preallocation window of a file
+// other than inum?  Caller holds fscache.lock.
+static int
+reserved(uint b, uint inum)
+{
+  int i;
+
+  for(i = 0; i < NPREALLOC; i++)
+    if(fscache.win[i].inum && fscache.win[i].inum != inum &&
+       b >= fscache.win[i].start && b < fscache.win[i].end)
+      return 1;
+  return 0;
+}
+
+// File inum has just been given block b.  Unless that was in
+// its window and there is more of the window after it, reserve
+// the PREALLOC blocks after b.  Caller holds fscache.lock.
 static void
-bzero(int dev, int bno)
+reserve(uint inum, uint b)
 {
-  struct buf *bp;
-  
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
-  bwrite(bp);
-  brelse(bp);
+  int i;
+
+  for(i = 0; i < NPREALLOC; i++)
+    if(fscache.win[i].inum == inum)
+      break;
+  if(i == NPREALLOC){
+    i = fscache.winhand;
+    fscache.winhand = (i + 1) % NPREALLOC;
+    fscache.win[i].inum = inum;
+  } else if(b >= fscache.win[i].start && b+1 < fscache.win[i].end)
+    return;
+  fscache.win[i].start = b + 1;
+  fscache.win[i].end = b + 1 + PREALLOC;
 }
 
-// Blocks. 
+// Drop the preallocation window of file inum, if it has one.
+static void
+unreserve(uint inum)
+{
+  int i;
+
+  acquire(&fscache.lock);
+  for(i = 0; i < NPREALLOC; i++)
+    if(fscache.win[i].inum == inum)
+      fscache.win[i].inum = 0;
+  release(&fscache.lock);
+}
+
+// Set up the file system on dev before first use.
+// Called once, from the first process, since it reads the disk.
+void
+fsinit(int dev)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  uint b, bi, inum;
+
+  initlock(&fscache.lock, "fscache");
+  readsb(dev, &fscache.sb);
+  if(fscache.sb.bsize != BSIZE && !(fscache.sb.bsize == 0 && BSIZE == 512))
+    panic("fsinit: block size");
+  if(fscache.sb.stripe && bstripe(dev, fscache.sb.stripe) < 0)
+    panic("fsinit: striped root needs IDE disk 2");
+  initlog(dev, &fscache.sb);
+
+  fscache.dev = dev;
+  fscache.nbmap = (fscache.sb.size + BPB-1) / BPB;
+  fscache.ngroup = (fscache.nbmap + AGBMAP-1) / AGBMAP;
+  fscache.ipg = (fscache.sb.ninodes + fscache.ngroup-1) / fscache.ngroup;
+  if(fscache.nbmap > PGSIZE / (2*sizeof(ushort)) || (fscache.nfree = (ushort*)kalloc()) == 0)
+    panic("fsinit: bitmap summary");
+  fscache.npend = fscache.nfree + fscache.nbmap;
+  memset(fscache.npend, 0, fscache.nbmap * sizeof(ushort));
+  if((fscache.pend = (uchar**)kalloc()) == 0)
+    panic("fsinit: pending frees");
+  memset(fscache.pend, 0, PGSIZE);
+  for(b = 0; b < fscache.sb.size; b += BPB){
+    bp = bread(dev, BBLOCK(b, fscache.sb.ninodes));
+    fscache.nfree[b/BPB] = 0;
+    for(bi = 0; bi < BPB && b + bi < fscache.sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        fscache.nfree[b/BPB]++;
+    brelse(bp);
+  }
 
-// Allocate a disk block.
+  if(fscache.sb.ninodes > PGSIZE*8 || (fscache.imap = (uchar*)kalloc()) == 0)
+    panic("fsinit: inode map");
+  memset(fscache.imap, 0, PGSIZE);
+  fscache.imap[0] = 1;  // inode 0 is not used
+  fscache.ihint = 1;
+  for(inum = 1; inum < fscache.sb.ninodes; inum++){
+    bp = bread(dev, IBLOCK(inum));
+    dip = (struct dinode*)bp->data + inum%IPB;
+    if(dip->type != 0)
+      fscache.imap[inum/8] |= 1 << (inum%8);
+    brelse(bp);
+  }
+}
+
+// Allocate a disk block, as close after goal as possible,
+// for file inum's data, or for metadata if inum is 0.  The
+// block is not zeroed on the disk: its first user gets it
+// with bnew, which zeroes it in memory.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal, uint inum)
 {
-  int b, bi, m;
+  int b, bi, m, i, n, start, pass;
   struct buf *bp;
-  struct superblock sb;
 
-  bp = 0;
-  readsb(dev, &sb);
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb.ninodes));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+  if(dev != fscache.dev)
+    panic("balloc: dev");
+
+  // Pick a bitmap block with a free bit, starting at the
+  // goal's, and claim one of its free blocks so no one else
+  // can take it.
+  acquire(&fscache.lock);
+  start = goal < fscache.sb.size ? goal : 0;
+ again:
+  for(n = 0; n < fscache.nbmap; n++){
+    i = (start/BPB + n) % fscache.nbmap;
+    if(fscache.nfree[i] > 0 && (fscache.npend[i] == 0 || fscache.pend[i]))
+      break;
+  }
+  if(n == fscache.nbmap)
+    panic("balloc: out of blocks");
+  fscache.nfree[i]--;
+  release(&fscache.lock);
+
+  // Find the free bit, starting at start if it is in this block.
+  b = i * BPB;
+  bp = bread(dev, BBLOCK(b, fscache.sb.ninodes));
+  acquire(&fscache.lock);
+  if(fscache.npend[i] > 0 && fscache.pend[i] == 0){
+    // bfree got here first, and had no page to mark.
+    fscache.nfree[i]++;
+    brelse(bp);
+    goto again;
+  }
+  if(start/BPB != i)
+    start = b;
+  // Stay out of other files' windows if possible.
+  for(pass = 0; pass < 2; pass++){
+    for(n = 0; n < BPB; n++){
+      bi = (start - b + n) % BPB;
+      if(b + bi >= fscache.sb.size)
+        continue;
       m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use on disk.
-        bwrite(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+      if((bp->data[bi/8] & m) != 0)  // Is block in use?
+        continue;
+      if(fscache.pend[i] && (fscache.pend[i][bi/8] & m) != 0)
+        continue;  // Freed, but not committed.
+      if(pass == 0 && reserved(b + bi, inum))
+        continue;
+      bp->data[bi/8] |= m;  // Mark block in use on disk.
+      if(inum)
+        reserve(inum, b + bi);
+      release(&fscache.lock);
+      log_write(bp);
+      brelse(bp);
+      return b + bi;
     }
-    brelse(bp);
   }
-  panic("balloc: out of blocks");
+  panic("balloc: summary");
 }
 
-// Free a disk block.
+// Free the n disk blocks starting at b, updating each
+// bitmap block once.  Their contents are left alone.
 static void
-bfree(int dev, uint b)
+bfree(int dev, uint b, uint n)
 {
   struct buf *bp;
-  struct superblock sb;
-  int bi, m;
-
-  bzero(dev, b);
-
-  readsb(dev, &sb);
-  bp = bread(dev, BBLOCK(b, sb.ninodes));
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;  // Mark block free on disk.
-  bwrite(bp);
-  brelse(bp);
+  uint i, bi, m, end, first, bn;
+  uchar *mem;
+
+  for(end = b + n; b < end; ){
+    bn = b / BPB;
+    mem = 0;
+    if(fscache.sb.nlog && fscache.pend[bn] == 0 && (mem = (uchar*)kalloc()) != 0)
+      memset(mem, 0, PGSIZE);
+    bp = bread(dev, BBLOCK(b, fscache.sb.ninodes));
+    first = b % BPB;
+    for(i = 0; b < end && (i == 0 || b % BPB != 0); i++, b++){
+      bi = b % BPB;
+      m = 1 << (bi % 8);
+      if((bp->data[bi/8] & m) == 0)
+        panic("freeing free block");
+      bp->data[bi/8] &= ~m;  // Mark block free on disk.
+    }
+    log_write(bp);
+
+    // Before anyone else can look at the bitmap block.
+    acquire(&fscache.lock);
+    if(fscache.sb.nlog){
+      // A block already holding untracked frees stays untracked.
+      if(fscache.pend[bn] == 0 && fscache.npend[bn] == 0 && mem){
+        fscache.pend[bn] = mem;
+        mem = 0;
+      }
+      if(fscache.pend[bn])
+        for(bi = first; bi < first + i; bi++)
+          fscache.pend[bn][bi/8] |= 1 << (bi % 8);
+      fscache.npend[bn] += i;
+    } else
+      fscache.nfree[bn] += i;
+    release(&fscache.lock);
+    brelse(bp);
+    if(mem)
+      kfree((char*)mem);
+  }
+}
+
+// The log has committed the transaction that freed the
+// blocks counted in npend, so they can be allocated.
+void
+bfreecommit(void)
+{
+  uint i;
+
+  acquire(&fscache.lock);
+  for(i = 0; i < fscache.nbmap; i++){
+    fscache.nfree[i] += fscache.npend[i];
+    fscache.npend[i] = 0;
+    if(fscache.pend[i]){
+      kfree((char*)fscache.pend[i]);
+      fscache.pend[i] = 0;
+    }
+  }
+  release(&fscache.lock);
+}
+
+// Should the running transaction commit before another FS
+// call starts, which with those running makes nop, so that
+// the blocks it freed can be allocated?  Yes if it freed any
+// and fewer than MAXOPALLOC blocks per call are free otherwise.
+int
+bfreelow(int nop)
+{
+  uint i, nfree, npend;
+
+  nfree = npend = 0;
+  acquire(&fscache.lock);
+  for(i = 0; i < fscache.nbmap; i++){
+    nfree += fscache.nfree[i];
+    npend += fscache.npend[i];
+  }
+  release(&fscache.lock);
+  return npend > 0 && nfree < nop*MAXOPALLOC;
 }
 
 // Inodes.
@@ -111,7 +390,10 @@ bfree(int dev, uint b)
 // 
 // ip->ref counts the number of pointer references to this cached
 // inode; references are typically kept in struct file and in proc->cwd.
-// When ip->ref falls to zero, the inode is no longer cached.
+// When ip->ref falls to zero, a valid inode stays cached on an LRU
+// list, so opening it again needs no disk read; iget reuses the
+// least recently used one once the cache holds NINODE inodes,
+// and grows the cache a page at a time when all are referenced.
 // It is an error to use an inode without holding a reference to it.
 //
 // Processes are only allowed to read and write inode
@@ -130,42 +412,96 @@ bfree(int dev, uint b)
 // responsibility to lock them before using them.  A non-zero
 // ip->ref keeps these unlocked inodes in the cache.
 
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev)*31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode *free;   // unused inodes, linked by hnext
+
+  // Unreferenced valid inodes, linked by prev/next.
+  // lru.next is least recently used.
+  struct inode lru;
+  int n;                // inodes allocated
+  int renaming;         // a dirrename is in progress
 } icache;
 
 void
 iinit(void)
 {
   initlock(&icache.lock, "icache");
+  icache.lru.prev = &icache.lru;
+  icache.lru.next = &icache.lru;
+  dcinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
 
-// Allocate a new inode with the given type on device dev.
+// Allocate a new inode with the given type on device dev,
+// for an entry in directory parent.  A directory goes in the
+// allocation group with the most free blocks, anything else
+// in its parent's group: the lowest free inode there or after
+// is found in fscache.imap, so this reads only the chosen
+// inode's block.
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, uint parent)
 {
-  int inum;
+  uint inum, g, best, n, start;
   struct buf *bp;
   struct dinode *dip;
-  struct superblock sb;
 
-  readsb(dev, &sb);
-  for(inum = 1; inum < sb.ninodes; inum++){  // loop over inode blocks
-    bp = bread(dev, IBLOCK(inum));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      bwrite(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
+  if(dev != fscache.dev)
+    panic("ialloc: dev");
+
+  acquire(&fscache.lock);
+  g = agofinode(parent);
+  if(type == T_DIR){
+    best = 0;
+    for(n = 0; n < fscache.ngroup; n++){
+      if(agfree(n) > best){
+        best = agfree(n);
+        g = n;
+      }
     }
-    brelse(bp);
   }
+  start = g * fscache.ipg;
+  if(start < fscache.ihint)
+    start = fscache.ihint;
+  for(inum = start; inum < fscache.sb.ninodes; inum++)
+    if((fscache.imap[inum/8] & (1 << (inum%8))) == 0)
+      goto found;
+  for(inum = fscache.ihint; inum < start; inum++)
+    if((fscache.imap[inum/8] & (1 << (inum%8))) == 0)
+      goto found;
   panic("ialloc: no inodes");
+
+found:
+  fscache.imap[inum/8] |= 1 << (inum%8);
+  if(inum == fscache.ihint)
+    fscache.ihint = inum + 1;
+  release(&fscache.lock);
+
+  bp = bread(dev, IBLOCK(inum));
+  dip = (struct dinode*)bp->data + inum%IPB;
+  if(dip->type != 0)
+    panic("ialloc: inode map");
+  memset(dip, 0, sizeof(*dip));
+  dip->type = type;
+  log_write(bp);   // mark it allocated on the disk
+  brelse(bp);
+  return iget(dev, inum);
+}
+
+// Note that inode inum, just marked free on disk, can be reused.
+static void
+ifree(uint dev, uint inum)
+{
+  acquire(&fscache.lock);
+  fscache.imap[inum/8] &= ~(1 << (inum%8));
+  if(inum < fscache.ihint)
+    fscache.ihint = inum;
+  release(&fscache.lock);
 }
 
 // Copy inode, which has changed, from memory to disk.
@@ -182,41 +518,90 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
-  bwrite(bp);
+  memmove(dip->ext, ip->ext, sizeof(ip->ext));
+  dip->extblk = ip->extblk;
+  memmove(dip->inl, ip->inl, sizeof(ip->inl));
+  log_write(bp);
   brelse(bp);
 }
 
+// Add a page of inodes to the free list.
+// Caller holds icache.lock.
+static int
+igrow(void)
+{
+  struct inode *ip;
+  char *p;
+
+  if((p = kalloc()) == 0)
+    return -1;
+  memset(p, 0, PGSIZE);
+  for(ip = (struct inode*)p; ip+1 <= (struct inode*)(p + PGSIZE); ip++){
+    ip->hnext = icache.free;
+    icache.free = ip;
+    icache.n++;
+  }
+  return 0;
+}
+
+static void
+lruremove(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+static void
+unhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+    ;
+  *pp = ip->hnext;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Try for cached inode.
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Allocate fresh inode.
-  if(empty == 0)
+  // Allocate fresh inode: recycle the least recently used
+  // one if the cache is full, or grow it.
+  if(icache.free == 0 && (icache.n < NINODE || icache.lru.next == &icache.lru))
+    igrow();
+  if(icache.free){
+    ip = icache.free;
+    icache.free = ip->hnext;
+  } else if(icache.lru.next != &icache.lru){
+    ip = icache.lru.next;
+    lruremove(ip);
+    unhash(ip);
+  } else
     panic("iget: no inodes");
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->flags = 0;
+  ip->ec.len = 0;
+  ip->ra = 0;
+  ip->hnext = icache.hash[IHASH(dev, inum)];
+  icache.hash[IHASH(dev, inum)] = ip;
   release(&icache.lock);
 
   return ip;
@@ -257,7 +642,10 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    memmove(ip->ext, dip->ext, sizeof(ip->ext));
+    ip->extblk = dip->extblk;
+    memmove(ip->inl, dip->inl, sizeof(ip->inl));
+    ip->ec.len = 0;
     brelse(bp);
     ip->flags |= I_VALID;
     if(ip->type == 0)
@@ -292,11 +680,26 @@ iput(struct inode *ip)
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
+    dcpurge(ip->dev, ip->inum);
+    ifree(ip->dev, ip->inum);
     acquire(&icache.lock);
     ip->flags = 0;
     wakeup(ip);
   }
-  ip->ref--;
+  if(--ip->ref == 0){
+    unreserve(ip->inum);
+    if(ip->flags & I_VALID){
+      // Most recently used.
+      ip->next = &icache.lru;
+      ip->prev = icache.lru.prev;
+      icache.lru.prev->next = ip;
+      icache.lru.prev = ip;
+    } else {
+      unhash(ip);
+      ip->hnext = icache.free;
+      icache.free = ip;
+    }
+  }
   release(&icache.lock);
 }
 
@@ -311,74 +714,103 @@ iunlockput(struct inode *ip)
 // Inode contents
 //
 // The contents (data) associated with each inode is stored
-// in a sequence of blocks on the disk.  The first NDIRECT blocks
-// are listed in ip->addrs[].  The next NINDIRECT blocks are 
-// listed in the block ip->addrs[NDIRECT].
+// in a list of extents, runs of consecutive blocks on the
+// disk (see fs.h).  The first NEXTENT extents are in
+// ip->ext[], the rest in the chain of extent blocks
+// starting at ip->extblk.  bmap remembers the extent it
+// found last in ip->ec, so reading or writing a file
+// sequentially looks at the list once per extent.
+//
+// A file of up to NINLINE bytes has no blocks: its contents
+// are in ip->inl, and written with the inode.  writei moves
+// them out to a block when the file grows past that.
+
+// Are ip's contents in the inode?
+static int
+isinline(struct inode *ip)
+{
+  return ip->ext[0].len == 0;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bn must be the block just past the
+// end of the file; bmap allocates it, growing the last extent
+// if the disk block after it is free.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
   struct buf *bp;
- // uint i;	
-  int a1, a2, a3, d1, d2, k1, k2, k3;	
-  //uint* addr_ptr;
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-    {
-      ip->addrs[bn] = addr = balloc(ip->dev);
-      //cprintf("bmap error!~0");
+  struct extent *e, *last;
+  uint i, n, lblk, llblk, addr, next;
+
+  if(ip->ec.len > 0 && bn >= ip->ec.lblk && bn < ip->ec.lblk + ip->ec.len)
+    return ip->ec.start + (bn - ip->ec.lblk);
+
+  // Walk the list, leaving e[i] as the first unused slot.
+  bp = 0;
+  e = ip->ext;
+  n = NEXTENT;
+  lblk = llblk = 0;
+  last = 0;
+  for(;;){
+    for(i = 0; i < n && e[i].len > 0; i++){
+      if(bn < lblk + e[i].len){
+        addr = e[i].start + (bn - lblk);
+        goto found;
+      }
+      last = &e[i];
+      llblk = lblk;
+      lblk += e[i].len;
     }
-    return addr;
-  }
-  bn -= NDIRECT;
-  addr= ip->addrs[NDIRECT];
-if(addr == 0)
-{
-//cprintf("bmap error!");
- addr= ip->addrs[NDIRECT] = balloc(ip->dev);
-}
- d1 = bn / 128;
- k1 = bn % 128;
- d2 = d1 / 128;
- k2 = d1 % 128;
-// d3 = d2 / 128;
- k3 = d2 % 128;
- bp = bread(ip->dev, addr);
-//cprintf("reading block %dover", addr);
- a = (uint*)bp->data;
-
- if((a1 = a[k3]) == 0)
- {
-    a1 = a[k3] = balloc(ip->dev);
-  // cprintf("error1");
- }
- brelse(bp);
-//cprintf("reading block %dover", a1);
- bp = bread(ip->dev, a1);
- a = (uint*)bp->data;
-
- if((a2 = a[k2]) == 0)
- {
-  a2 = a[k2] = balloc(ip->dev);
-//cprintf("error1");
- }
-
- brelse(bp);
-//cprintf("reading block %dover", a2);
- bp = bread(ip->dev, a2);
- a = (uint*)bp->data;
-
- if((a3 = a[k1]) == 0)
- {
-  a3 = a[k1] = balloc(ip->dev);
-//cprintf("error1");
- }
-//cprintf("return addr:%d", a3);
-brelse(bp);
- return a3;
+    if(i < n)
+      break;
+    next = bp ? e[NEXTBLK].start : ip->extblk;
+    if(next == 0)
+      break;
+    if(bp)
+      brelse(bp);
+    bp = bread(ip->dev, next);
+    e = (struct extent*)bp->data;
+    n = NEXTBLK;
+    last = 0;
+  }
+  if(bn != lblk)
+    panic("bmap: past end");
+
+  addr = balloc(ip->dev, last ? last->start + last->len : agstart(agofinode(ip->inum)),
+                ip->inum);
+  if(last && addr == last->start + last->len){
+    last->len++;
+    i = last - e;
+    lblk = llblk;
+  } else {
+    if(i == n){
+      // Out of slots: chain a new extent block.
+      next = balloc(ip->dev, addr, 0);
+      if(bp){
+        e[NEXTBLK].start = next;
+        log_write(bp);
+        brelse(bp);
+      } else
+        ip->extblk = next;
+      bp = bnew(ip->dev, next);
+      e = (struct extent*)bp->data;
+      i = 0;
+    }
+    e[i].start = addr;
+    e[i].len = 1;
+  }
+  if(bp)
+    log_write(bp);
+  // The caller (writei) writes the inode.
+
+found:
+  ip->ec.lblk = lblk;
+  ip->ec.start = e[i].start;
+  ip->ec.len = e[i].len;
+  if(bp)
+    brelse(bp);
+  return addr;
 }
 
 // Truncate inode (discard contents).
@@ -387,32 +819,28 @@ brelse(bp);
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
+  int i;
   struct buf *bp;
-  uint *a;
-  uint* addr_ptr, *temp;
-  cprintf("itrunc");
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
+  struct extent *e;
+  uint blk, next;
+
+  pcinval(ip->dev, ip->inum);
+  for(i = 0; i < NEXTENT && ip->ext[i].len > 0; i++){
+    bfree(ip->dev, ip->ext[i].start, ip->ext[i].len);
+    ip->ext[i].start = ip->ext[i].len = 0;
   }
-  addr_ptr = &(ip->addrs[NDIRECT]);
-  while(*addr_ptr)
-  {
-    bp = bread(ip->dev, *addr_ptr);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT - 1; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    temp = &(a[NINDIRECT - 1]);
+  for(blk = ip->extblk; blk; blk = next){
+    bp = bread(ip->dev, blk);
+    e = (struct extent*)bp->data;
+    for(i = 0; i < NEXTBLK && e[i].len > 0; i++)
+      bfree(ip->dev, e[i].start, e[i].len);
+    next = e[NEXTBLK].start;
     brelse(bp);
-    bfree(ip->dev, *addr_ptr);
-    *addr_ptr = 0;
-    addr_ptr = temp;
+    bfree(ip->dev, blk, 1);
   }
+  ip->extblk = 0;
+  ip->ec.len = 0;
+  memset(ip->inl, 0, sizeof(ip->inl));
 
   ip->size = 0;
   iupdate(ip);
@@ -429,12 +857,74 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Blocks of page pg of file ip that are in the file
+// but not valid, one bit each.
+static uint
+pmissing(struct inode *ip, struct page *pg)
+{
+  uint first, nb;
+
+  first = pg->pgno * PGBLOCKS;
+  nb = (ip->size + BSIZE-1) / BSIZE;
+  if(nb <= first)
+    return 0;
+  nb = min(nb - first, PGBLOCKS);
+  return ((1 << nb) - 1) & ~pg->valid;
+}
+
+// Read in the blocks of the locked pages pv[0..n-1] of file
+// ip that are in the file but not valid.
+static void
+pfill(struct inode *ip, struct page **pv, int n)
+{
+  uint i, bi, m;
+
+  for(i = 0; i < n; i++){
+    m = pmissing(ip, pv[i]);
+    for(bi = 0; bi < PGBLOCKS; bi++)
+      if((m & (1<<bi)) && pv[i]->addr[bi] == 0)
+        pv[i]->addr[bi] = bmap(ip, pv[i]->pgno*PGBLOCKS + bi);
+  }
+  pread(pv, n);
+}
+
+// Return page pgno of regular file ip, locked, with all of it
+// that is in the file valid.  A sequential reader, one that
+// asks for the page after the last one it missed on, gets the
+// pages after it filled too, up to NREADAHEAD blocks, in the
+// same batch of disk requests.  Returns 0 if out of memory.
+static struct page*
+pgetfile(struct inode *ip, uint pgno)
+{
+  struct page *pv[NPREAD];
+  uint npg;
+  int i, n;
+
+  if((pv[0] = pget(ip->dev, ip->inum, pgno)) == 0)
+    return 0;
+  if(pmissing(ip, pv[0]) == 0)
+    return pv[0];
+  n = 1;
+  if(pgno == ip->ra){
+    npg = (ip->size + PGSIZE-1) / PGSIZE;
+    for(; n < NPREAD && pgno+n < npg; n++)
+      if((pv[n] = pget(ip->dev, ip->inum, pgno+n)) == 0)
+        break;
+  }
+  pfill(ip, pv, n);
+  for(i = 1; i < n; i++)
+    prelse(pv[i]);
+  ip->ra = pgno + n;
+  return pv[0];
+}
+
 // Read data from inode.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  struct page *pg;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -447,6 +937,22 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(isinline(ip)){
+    memmove(dst, ip->inl + off, n);
+    return n;
+  }
+
+  if(ip->type == T_FILE){
+    for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+      if((pg = pgetfile(ip, off/PGSIZE)) == 0)
+        return -1;
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      memmove(dst, pg->data + off%PGSIZE, m);
+      prelse(pg);
+    }
+    return n;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -456,12 +962,76 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   return n;
 }
 
+// Copy n bytes from src to off in page pg of regular file ip,
+// where they fit, allocating the blocks they go in if they
+// are past nb, the number of blocks in the file.  Only a block
+// that is in the file and partly written is read first: a new
+// one is zeroed instead.  Returns -1 if out of memory.
+static int
+pgwrite(struct inode *ip, struct page *pg, uint nb, char *src, uint off, uint n)
+{
+  uint bi, first, last, bn, mask;
+
+  if(pown(pg) < 0)
+    return -1;
+  first = off / BSIZE;
+  last = (off + n - 1) / BSIZE;
+  mask = 0;
+  for(bi = first; bi <= last; bi++)
+    mask |= 1 << bi;
+
+  bn = pg->pgno*PGBLOCKS;
+  if((off % BSIZE != 0 && bn+first < nb && !(pg->valid & (1<<first))) ||
+     ((off+n) % BSIZE != 0 && bn+last < nb && !(pg->valid & (1<<last))))
+    pfill(ip, &pg, 1);
+
+  for(bi = first; bi <= last; bi++){
+    if(bn+bi < nb){
+      if(pg->addr[bi] == 0)
+        pg->addr[bi] = bmap(ip, bn+bi);
+    } else {
+      pg->addr[bi] = bmap(ip, bn+bi);
+      bforget(ip->dev, pg->addr[bi]);
+      if(!(pg->valid & (1<<bi)))
+        memset(pg->data + bi*BSIZE, 0, BSIZE);
+    }
+  }
+  memmove(pg->data + off, src, n);
+  pg->valid |= mask;
+  pdirty(pg, mask);
+  return 0;
+}
+
+// Small file ip is about to grow past NINLINE bytes: move
+// its contents from the inode to its first block.
+static int
+spill(struct inode *ip)
+{
+  char buf[NINLINE];
+  struct page *pg;
+  uint n;
+
+  if((pg = pget(ip->dev, ip->inum, 0)) == 0)
+    return -1;
+  n = ip->size;
+  memmove(buf, ip->inl, n);
+  if(pgwrite(ip, pg, 0, buf, 0, n) < 0){
+    prelse(pg);
+    return -1;
+  }
+  memset(ip->inl, 0, sizeof(ip->inl));
+  prelse(pg);
+  iupdate(ip);
+  return 0;
+}
+
 // Write data to inode.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, nb;
   struct buf *bp;
+  struct page *pg;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -474,27 +1044,423 @@ writei(struct inode *ip, char *src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  if(ip->type == T_FILE && isinline(ip)){
+    if(off + n <= NINLINE){
+      memmove(ip->inl + off, src, n);
+      if(off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      return n;
+    }
+    if(ip->size > 0 && spill(ip) < 0)
+      return -1;
+  }
+
+  nb = (ip->size + BSIZE-1) / BSIZE;
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if(ip->type == T_FILE){
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      if((pg = pget(ip->dev, ip->inum, off/PGSIZE)) == 0)
+        break;
+      if(pgwrite(ip, pg, nb, src, off%PGSIZE, m) < 0){
+        prelse(pg);
+        break;
+      }
+      prelse(pg);
+      continue;
+    }
     m = min(n - tot, BSIZE - off%BSIZE);
+    // Read the block only if part of it is to be kept:
+    // a new block, or one being overwritten whole, is
+    // zeroed in memory instead.
+    if(m == BSIZE || off/BSIZE >= nb)
+      bp = bnew(ip->dev, bmap(ip, off/BSIZE));
+    else
+      bp = bread(ip->dev, bmap(ip, off/BSIZE));
     memmove(bp->data + off%BSIZE, src, m);
-    bwrite(bp);
+    log_write(bp);
     brelse(bp);
   }
 
-  if(n > 0 && off > ip->size){
+  if(tot > 0 && off > ip->size){
     ip->size = off;
     iupdate(ip);
   }
-  return n;
+  return tot > 0 || n == 0 ? tot : -1;
+}
+
+// Return the memory of the cached page of regular file ip that
+// holds byte off, with a reference the caller must kfree (see
+// kdup in kalloc.c), and set *n to the bytes of the file from
+// off to the end of the page.  Returns 0 if the data is not in
+// a page, or off is at the end of the file; the caller then
+// uses readi.  Caller holds ip's lock.
+char*
+igetpage(struct inode *ip, uint off, uint *n)
+{
+  struct page *pg;
+  char *mem;
+
+  if(ip->type != T_FILE || isinline(ip) || off >= ip->size)
+    return 0;
+  if((pg = pgetfile(ip, off/PGSIZE)) == 0)
+    return 0;
+  mem = pg->data;
+  kdup(mem);
+  prelse(pg);
+  *n = min(ip->size - off, PGSIZE - off%PGSIZE);
+  return mem;
+}
+
+// Make mem, a page of memory the caller owns, the page of
+// regular file ip at off, instead of copying it there with
+// writei.  off must be page aligned and no more than the size
+// of ip.  Returns -1, leaving mem to the caller, if it cannot.
+// Caller holds ip's lock, in a transaction.
+int
+iputpage(struct inode *ip, char *mem, uint off)
+{
+  struct page *pg;
+  uint bi, bn, nb;
+
+  if(ip->type != T_FILE || off % PGSIZE != 0 || off > ip->size ||
+     off + PGSIZE > MAXFILE*BSIZE || (isinline(ip) && ip->size > 0))
+    return -1;
+  if((pg = pget(ip->dev, ip->inum, off/PGSIZE)) == 0)
+    return -1;
+  nb = (ip->size + BSIZE-1) / BSIZE;
+  bn = pg->pgno*PGBLOCKS;
+  for(bi = 0; bi < PGBLOCKS; bi++){
+    if(bn+bi < nb){
+      if(pg->addr[bi] == 0)
+        pg->addr[bi] = bmap(ip, bn+bi);
+    } else {
+      pg->addr[bi] = bmap(ip, bn+bi);
+      bforget(ip->dev, pg->addr[bi]);
+    }
+  }
+  kfree(pswap(pg, mem));
+  pg->valid = (1<<PGBLOCKS) - 1;
+  pdirty(pg, pg->valid);
+  prelse(pg);
+  if(off + PGSIZE > ip->size){
+    ip->size = off + PGSIZE;
+    iupdate(ip);
+  }
+  return PGSIZE;
 }
 
 // Directories
+//
+// A directory is either an array of struct dirent, as made by
+// older versions of mkfs, or a hashed directory (see fs.h):
+// a header block holding the first block of each hash bucket's
+// chain, then blocks of variable-length entries.  Looking up
+// a name in a hashed directory reads only the blocks of its
+// bucket.  New directories keep the same entries in the inode
+// until they outgrow it, then are hashed; old ones are
+// searched linearly.
 
 int
 namecmp(const char *s, const char *t)
 {
-  return strncmp(s, t, DIRSIZ);
+  return strncmp(s, t, MAXNAME);
+}
+
+static uint
+namehash(char *name)
+{
+  uint h;
+
+  for(h = 0; *name; name++)
+    h = h*31 + (uchar)*name;
+  return h;
+}
+
+static uint
+dirhash(char *name)
+{
+  return namehash(name) % NDIRHASH;
+}
+
+// Name cache.
+//
+// dcache remembers recent dirlookup results, including names
+// that were not found, so a hot path is walked without reading
+// directory blocks.  Entries are keyed by device, directory inode
+// and name; names longer than DCNAMELEN are not cached.  dirlink
+// and dirunlink update it while holding the directory's lock, and
+// iput drops the entries of directories it frees.
+
+#define DCNAMELEN 27
+#define NDCHASH 61
+
+struct dentry {
+  uint dev;
+  uint dinum;           // directory; 0 if unused
+  uint inum;            // 0 if name is not in the directory
+  char name[DCNAMELEN+1];
+  struct dentry *next;  // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDCACHE];
+  struct dentry *hash[NDCHASH];
+  int hand;             // next entry to reuse
+} dcache;
+
+static void
+dcinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+// Find the entry for name in dp.  Caller holds dcache.lock.
+static struct dentry*
+dcfind(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[namehash(name) % NDCHASH]; d; d = d->next)
+    if(d->dinum == dp->inum && d->dev == dp->dev && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Take d off its hash chain and mark it unused.
+// Caller holds dcache.lock.
+static void
+dcunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  if(d->dinum == 0)
+    return;
+  for(pp = &dcache.hash[namehash(d->name) % NDCHASH]; *pp != d; pp = &(*pp)->next)
+    ;
+  *pp = d->next;
+  d->dinum = 0;
+}
+
+// Look up name in dp in the cache.  Returns 1 and sets *inum
+// (0 if name is known to be absent) if it is there.
+static int
+dcget(struct inode *dp, char *name, uint *inum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp, name)) != 0)
+    *inum = d->inum;
+  release(&dcache.lock);
+  return d != 0;
+}
+
+// Record that name in dp is inum, or absent if inum is 0.
+static void
+dcset(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *d;
+  uint h;
+
+  if(strlen(name) > DCNAMELEN)
+    return;
+  acquire(&dcache.lock);
+  if((d = dcfind(dp, name)) == 0){
+    d = &dcache.ent[dcache.hand];
+    dcache.hand = (dcache.hand + 1) % NDCACHE;
+    dcunhash(d);
+    d->dev = dp->dev;
+    d->dinum = dp->inum;
+    safestrcpy(d->name, name, sizeof(d->name));
+    h = namehash(name) % NDCHASH;
+    d->next = dcache.hash[h];
+    dcache.hash[h] = d;
+  }
+  d->inum = inum;
+  release(&dcache.lock);
+}
+
+// Drop the entries of dp whose names start with the
+// DIRSIZ bytes of name, which all mean the same entry
+// in an old directory.
+static void
+dcinvalold(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < &dcache.ent[NDCACHE]; d++)
+    if(d->dinum == dp->inum && d->dev == dp->dev && strncmp(d->name, name, DIRSIZ) == 0)
+      dcunhash(d);
+  release(&dcache.lock);
+}
+
+// Drop the entries of directory inum, which is being freed.
+static void
+dcpurge(uint dev, uint inum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < &dcache.ent[NDCACHE]; d++)
+    if(d->dinum == inum && d->dev == dev)
+      dcunhash(d);
+  release(&dcache.lock);
+}
+
+// Is dp a hashed directory?
+static int
+ishashed(struct inode *dp)
+{
+  struct buf *bp;
+  int r;
+
+  if(dp->size < BSIZE)
+    return 0;
+  bp = bread(dp->dev, bmap(dp, 0));
+  r = ((struct dirhead*)bp->data)->magic == DIRMAGIC;
+  brelse(bp);
+  return r;
+}
+
+// Read the next entry at or after *off in dp into name, which
+// must have room for MAXNAME+1 bytes, and *inum, skipping free
+// slots, and advance *off past it.  Returns 0 at the end.
+static int
+dirnext(struct inode *dp, uint *off, char *name, uint *inum)
+{
+  struct buf *bp;
+  struct dirent de;
+  struct hdirent *he;
+
+  if(isinline(dp)){
+    if(*off < sizeof(uint))
+      *off = sizeof(uint);
+    while(*off < dp->size){
+      he = (struct hdirent*)(dp->inl + *off);
+      if(he->reclen == 0)
+        panic("dirnext: bad entry");
+      *off += he->reclen;
+      if(he->inum != 0){
+        memmove(name, he->name, he->namelen);
+        name[he->namelen] = 0;
+        *inum = he->inum;
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  if(!ishashed(dp)){
+    for(; *off < dp->size; *off += sizeof(de)){
+      if(readi(dp, (char*)&de, *off, sizeof(de)) != sizeof(de))
+        panic("dirnext read");
+      if(de.inum == 0)
+        continue;
+      *off += sizeof(de);
+      memmove(name, de.name, DIRSIZ);
+      name[DIRSIZ] = 0;
+      *inum = de.inum;
+      return 1;
+    }
+    return 0;
+  }
+
+  if(*off < BSIZE)
+    *off = BSIZE;
+  while(*off < dp->size){
+    if(*off % BSIZE == 0)
+      *off += sizeof(uint);  // skip the chain link
+    bp = bread(dp->dev, bmap(dp, *off / BSIZE));
+    he = (struct hdirent*)(bp->data + *off % BSIZE);
+    if(he->reclen == 0)
+      panic("dirnext: bad entry");
+    *off += he->reclen;
+    if(he->inum != 0){
+      memmove(name, he->name, he->namelen);
+      name[he->namelen] = 0;
+      *inum = he->inum;
+      brelse(bp);
+      return 1;
+    }
+    brelse(bp);
+  }
+  return 0;
+}
+
+#define NDENTREF 16  // inodes dirread holds at once
+
+// Fill dst, which holds n bytes, with dents for the entries of
+// directory dp from *off on, and advance *off past them.  The
+// names are read, and their inodes referenced, with dp locked;
+// each inode is locked with dp unlocked, as namex does, so ".."
+// needs no special care.  This goes NDENTREF entries at a time.
+// Returns the bytes filled, 0 at the end, or -1 if dst cannot
+// hold the next entry.  Caller holds a reference to dp, not
+// locked, in a transaction.
+int
+dirread(struct inode *dp, uint *off, char *dst, uint n)
+{
+  char name[MAXNAME+1];
+  struct dent *d;
+  struct inode *ip[NDENTREF];
+  uint o, inum, tot, len, start;
+  int i, k, full;
+
+  tot = 0;
+  full = 0;
+  do {
+    ilock(dp);
+    if(dp->type != T_DIR){
+      iunlock(dp);
+      return -1;
+    }
+    start = tot;
+    o = *off;
+    for(k = 0; k < NDENTREF && dirnext(dp, &o, name, &inum); k++, *off = o){
+      len = DENTSIZE(strlen(name));
+      if(tot + len > n){
+        full = 1;
+        break;
+      }
+      d = (struct dent*)(dst + tot);
+      d->inum = inum;
+      d->reclen = len;
+      d->namelen = strlen(name);
+      memmove(d->name, name, d->namelen + 1);
+      ip[k] = iget(dp->dev, inum);
+      tot += len;
+    }
+    iunlock(dp);
+
+    for(i = 0, o = start; i < k; i++, o += d->reclen){
+      d = (struct dent*)(dst + o);
+      ilock(ip[i]);
+      d->type = ip[i]->type;
+      d->size = ip[i]->size;
+      iunlockput(ip[i]);
+    }
+  } while(k == NDENTREF && !full);
+
+  if(tot == 0 && full)
+    return -1;
+  return tot;
+}
+
+// Is the directory dp empty except for "." and ".." ?
+int
+isdirempty(struct inode *dp)
+{
+  uint off, inum;
+  char name[MAXNAME+1];
+
+  off = 0;
+  while(dirnext(dp, &off, name, &inum))
+    if(namecmp(name, ".") != 0 && namecmp(name, "..") != 0)
+      return 0;
+  return 1;
 }
 
 // Look for a directory entry in a directory.
@@ -503,36 +1469,163 @@ namecmp(const char *s, const char *t)
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint inum;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
+  // Callers that want the offset are about to change dp.
+  if(poff == 0 && dcget(dp, name, &inum))
+    return inum ? iget(dp->dev, inum) : 0;
+  inum = dirlookup1(dp, name, poff);
+  dcset(dp, name, inum);
+  return inum ? iget(dp->dev, inum) : 0;
+}
+
+// Look for name among the hdirents in blk[sizeof(uint)..size);
+// return its offset, or 0.
+static uint
+hdirfind(uchar *blk, uint size, char *name)
+{
+  uint off, len;
+  struct hdirent *he;
+
+  len = strlen(name);
+  for(off = sizeof(uint); off < size; off += he->reclen){
+    he = (struct hdirent*)(blk + off);
+    if(he->reclen == 0)
+      panic("dirlookup: bad entry");
+    if(he->inum != 0 && he->namelen == len && memcmp(he->name, name, len) == 0)
+      return off;
+  }
+  return 0;
+}
+
+// Look for name in dp on disk; return its inum or 0.
+static uint
+dirlookup1(struct inode *dp, char *name, uint *poff)
+{
+  uint off, inum, bn, next;
+  struct dirent de;
+  struct buf *bp;
+
+  if(isinline(dp)){
+    if((off = hdirfind(dp->inl, dp->size, name)) == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return ((struct hdirent*)(dp->inl + off))->inum;
+  }
+
+  if(!ishashed(dp)){
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink read");
+      if(de.inum == 0)
+        continue;
+      if(strncmp(name, de.name, DIRSIZ) == 0){
+        // entry matches path element
+        if(poff)
+          *poff = off;
+        return de.inum;
+      }
+    }
+    return 0;
+  }
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  bn = ((struct dirhead*)bp->data)->bucket[dirhash(name)];
+  brelse(bp);
+  for(; bn != 0; bn = next){
+    bp = bread(dp->dev, bmap(dp, bn));
+    if((off = hdirfind(bp->data, BSIZE, name)) != 0){
       if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+        *poff = bn*BSIZE + off;
+      inum = ((struct hdirent*)(bp->data + off))->inum;
+      brelse(bp);
+      return inum;
     }
-    //brelse(bp);
+    next = *(uint*)bp->data;
+    brelse(bp);
   }
   return 0;
 }
 
+// Add entry (name, inum) to the hdirents in blk[sizeof(uint)..size)
+// if they have room, splitting the free space of an existing
+// entry.  The caller writes blk.
+static int
+hdiradd(uchar *blk, uint size, char *name, uint inum)
+{
+  uint off, used, need;
+  struct hdirent *he, *ne;
+
+  need = HDIRENTSIZE(strlen(name));
+  for(off = sizeof(uint); off < size; off += he->reclen){
+    he = (struct hdirent*)(blk + off);
+    used = he->inum ? HDIRENTSIZE(he->namelen) : 0;
+    if(he->reclen - used < need)
+      continue;
+    ne = he;
+    if(used > 0){
+      ne = (struct hdirent*)(blk + off + used);
+      ne->reclen = he->reclen - used;
+      he->reclen = used;
+    }
+    ne->inum = inum;
+    ne->namelen = strlen(name);
+    memmove(ne->name, name, ne->namelen);
+    return 1;
+  }
+  return 0;
+}
+
+// Directory dp has outgrown its inode: make it a hashed
+// directory whose buckets' chains all start at block 1,
+// which holds the entries that were in the inode.
+static void
+dirspill(struct inode *dp)
+{
+  struct buf *bp;
+  struct dirhead *dh;
+  struct hdirent *he;
+  uint off, h;
+
+  bp = bnew(dp->dev, bmap(dp, 0));
+  dh = (struct dirhead*)bp->data;
+  dh->magic = DIRMAGIC;
+  for(h = 0; h < NDIRHASH; h++)
+    dh->bucket[h] = 1;
+  log_write(bp);
+  brelse(bp);
+
+  bp = bnew(dp->dev, bmap(dp, 1));
+  memmove(bp->data, dp->inl, NINLINE);
+  *(uint*)bp->data = 0;  // end of every chain
+  for(off = sizeof(uint); ; off += he->reclen){
+    he = (struct hdirent*)(bp->data + off);
+    if(off + he->reclen >= NINLINE)
+      break;
+  }
+  he->reclen = BSIZE - off;
+  log_write(bp);
+  brelse(bp);
+
+  memset(dp->inl, 0, sizeof(dp->inl));
+  dp->size = 2*BSIZE;
+  iupdate(dp);
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
+  uint h, bn, next;
   struct dirent de;
   struct inode *ip;
+  struct buf *bp, *hp;
+  struct hdirent *he;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -540,22 +1633,277 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  if(dp->size == 0){
+    // New directory: its entries start out in the inode.
+    *(uint*)dp->inl = DIRINLINE;
+    he = (struct hdirent*)(dp->inl + sizeof(uint));
+    he->inum = 0;
+    he->reclen = NINLINE - sizeof(uint);
+    dp->size = NINLINE;
   }
 
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
-  
+  if(!isinline(dp) && !ishashed(dp)){
+    // Look for an empty dirent.
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink read");
+      if(de.inum == 0)
+        break;
+    }
+
+    strncpy(de.name, name, DIRSIZ);
+    de.inum = inum;
+    if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirlink");
+    dcinvalold(dp, name);
+    return 0;
+  }
+
+  dcset(dp, name, inum);
+
+  if(isinline(dp)){
+    if(hdiradd(dp->inl, NINLINE, name, inum)){
+      iupdate(dp);
+      return 0;
+    }
+    dirspill(dp);
+  }
+
+  // Look for room in the bucket's blocks.
+  h = dirhash(name);
+  hp = bread(dp->dev, bmap(dp, 0));
+  for(bn = ((struct dirhead*)hp->data)->bucket[h]; bn != 0; bn = next){
+    bp = bread(dp->dev, bmap(dp, bn));
+    if(hdiradd(bp->data, BSIZE, name, inum)){
+      log_write(bp);
+      brelse(bp);
+      brelse(hp);
+      return 0;
+    }
+    next = *(uint*)bp->data;
+    brelse(bp);
+  }
+
+  // None: start a new block at the head of the chain.
+  bn = dp->size / BSIZE;
+  bp = bnew(dp->dev, bmap(dp, bn));
+  *(uint*)bp->data = ((struct dirhead*)hp->data)->bucket[h];
+  he = (struct hdirent*)(bp->data + sizeof(uint));
+  he->reclen = BSIZE - sizeof(uint);
+  if(!hdiradd(bp->data, BSIZE, name, inum))
+    panic("dirlink: hdiradd");
+  log_write(bp);
+  brelse(bp);
+  dp->size += BSIZE;
+  iupdate(dp);
+  ((struct dirhead*)hp->data)->bucket[h] = bn;
+  log_write(hp);
+  brelse(hp);
   return 0;
 }
 
+// Remove the hdirent at offset off in blk, giving its space to
+// the previous entry, if any, and copy its name to name.
+static void
+hdirdel(uchar *blk, uint off, char *name)
+{
+  struct hdirent *he, *prev;
+  uint o;
+
+  prev = 0;
+  for(o = sizeof(uint); o < off; o += prev->reclen)
+    prev = (struct hdirent*)(blk + o);
+  if(o != off)
+    panic("dirunlink: off");
+  he = (struct hdirent*)(blk + o);
+  memmove(name, he->name, he->namelen);
+  name[he->namelen] = 0;
+  if(prev)
+    prev->reclen += he->reclen;
+  else
+    he->inum = 0;
+}
+
+// Remove the directory entry at byte offset off in dp,
+// as returned by dirlookup.
+void
+dirunlink(struct inode *dp, uint off)
+{
+  struct dirent de;
+  struct buf *bp;
+  char name[MAXNAME+1];
+
+  if(isinline(dp)){
+    hdirdel(dp->inl, off, name);
+    iupdate(dp);
+    dcset(dp, name, 0);
+    return;
+  }
+
+  if(!ishashed(dp)){
+    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirunlink: readi");
+    dcinvalold(dp, de.name);
+    memset(&de, 0, sizeof(de));
+    if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirunlink: writei");
+    return;
+  }
+
+  bp = bread(dp->dev, bmap(dp, off / BSIZE));
+  hdirdel(bp->data, off % BSIZE, name);
+  log_write(bp);
+  brelse(bp);
+  dcset(dp, name, 0);
+}
+
+// Is directory a dp or one of dp's ancestors?
+// Neither is locked.
+static int
+isancestor(struct inode *a, struct inode *dp)
+{
+  struct inode *ip, *next;
+
+  ip = idup(dp);
+  while(ip->inum != a->inum || ip->dev != a->dev){
+    if(ip->inum == ROOTINO){
+      iput(ip);
+      return 0;
+    }
+    ilock(ip);
+    next = dirlookup(ip, "..", 0);
+    iunlockput(ip);
+    if((ip = next) == 0)
+      return 0;
+  }
+  iput(ip);
+  return 1;
+}
+
+// Look up name in dp, which is not locked.
+static struct inode*
+peek(struct inode *dp, char *name)
+{
+  struct inode *ip;
+
+  ilock(dp);
+  ip = dirlookup(dp, name, 0);
+  iunlock(dp);
+  return ip;
+}
+
+// Rename oname in odp to nname in ndp, in place of whatever
+// nname was: a file may replace a file, and a directory an
+// empty directory.  Renames are done one at a time, so the tree
+// keeps its shape while one checks that a directory does not
+// move below itself and locks directories from the root down,
+// as lookups do.  Caller holds references to odp and ndp, not
+// locked, in a transaction.
+int
+dirrename(struct inode *odp, char *oname, struct inode *ndp, char *nname)
+{
+  struct inode *ip, *tp, *xp, *dp;
+  uint ooff, noff, off;
+  int r;
+
+  if(namecmp(oname, ".") == 0 || namecmp(oname, "..") == 0 ||
+     namecmp(nname, ".") == 0 || namecmp(nname, "..") == 0 ||
+     odp->dev != ndp->dev)
+    return -1;
+
+  acquire(&icache.lock);
+  while(icache.renaming)
+    sleep(&icache.renaming, &icache.lock);
+  icache.renaming = 1;
+  release(&icache.lock);
+
+  r = -1;
+  ip = tp = 0;
+  if((ip = peek(odp, oname)) == 0)
+    goto out;
+  tp = peek(ndp, nname);
+  if(isancestor(ip, ndp) || (tp && isancestor(tp, odp)))
+    goto out;
+
+  if(odp != ndp && isancestor(ndp, odp)){
+    ilock(ndp);
+    ilock(odp);
+  } else {
+    ilock(odp);
+    if(ndp != odp)
+      ilock(ndp);
+  }
+  xp = dirlookup(odp, oname, &ooff);
+  dp = dirlookup(ndp, nname, &noff);
+  if(xp)
+    iput(xp);
+  if(dp)
+    iput(dp);
+  if(xp != ip || dp != tp)  // changed before we locked
+    goto unlock;
+  if(tp == ip){
+    r = 0;  // names of the same file
+    goto unlock;
+  }
+
+  ilock(ip);
+  if(tp){
+    ilock(tp);
+    if(tp->type == T_DIR ? ip->type != T_DIR || !isdirempty(tp) : ip->type == T_DIR){
+      iunlock(tp);
+      iunlock(ip);
+      goto unlock;
+    }
+    dirunlink(ndp, noff);
+    if(tp->type == T_DIR){
+      ndp->nlink--;
+      iupdate(ndp);
+    }
+    tp->nlink--;
+    iupdate(tp);
+    iunlock(tp);
+  }
+  if(dirlink(ndp, nname, ip->inum) < 0){
+    if(tp)
+      panic("dirrename: dirlink");
+    iunlock(ip);
+    goto unlock;
+  }
+  if(ip->type == T_DIR && odp != ndp){
+    if((xp = dirlookup(ip, "..", &off)) == 0)
+      panic("dirrename: no ..");
+    iput(xp);
+    dirunlink(ip, off);
+    if(dirlink(ip, "..", ndp->inum) < 0)
+      panic("dirrename: ..");
+    odp->nlink--;
+    iupdate(odp);
+    ndp->nlink++;
+    iupdate(ndp);
+  }
+  iunlock(ip);
+  // dirlink may have moved the old entry.
+  if((xp = dirlookup(odp, oname, &ooff)) != 0)
+    iput(xp);
+  dirunlink(odp, ooff);
+  r = 0;
+
+ unlock:
+  iunlock(odp);
+  if(ndp != odp)
+    iunlock(ndp);
+ out:
+  if(ip)
+    iput(ip);
+  if(tp)
+    iput(tp);
+  acquire(&icache.lock);
+  icache.renaming = 0;
+  wakeup(&icache.renaming);
+  release(&icache.lock);
+  return r;
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -584,12 +1932,10 @@ skipelem(char *path, char *name)
   while(*path != '/' && *path != 0)
     path++;
   len = path - s;
-  if(len >= DIRSIZ)
-    memmove(name, s, DIRSIZ);
-  else {
-    memmove(name, s, len);
-    name[len] = 0;
-  }
+  if(len > MAXNAME)
+    len = MAXNAME;
+  memmove(name, s, len);
+  name[len] = 0;
   while(*path == '/')
     path++;
   return path;
@@ -597,7 +1943,7 @@ skipelem(char *path, char *name)
 
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
-// path element into name, which must have room for DIRSIZ bytes.
+// path element into name, which must have room for MAXNAME+1 bytes.
 static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
@@ -636,7 +1982,7 @@ namex(char *path, int nameiparent, char *name)
 struct inode*
 namei(char *path)
 {
-  char name[DIRSIZ];
+  char name[MAXNAME+1];
   return namex(path, 0, name);
 }
 
@@ -3,21 +3,47 @@
 
 // Block 0 is unused.
 // Block 1 is super block.
-// Inodes start at block 2.
+// Inodes start at block 2, followed by the block bitmap,
+// the log (if nlog > 0) and the data blocks.
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+
+// Block size.  Any multiple of the 512-byte disk sector up to
+// 4096 works; mkfs and the kernel must be built with the same
+// one.  mkfs records it in the superblock, and the kernel will
+// not mount a file system with blocks of another size.
+#define BSIZE 4096
+#define SPB (BSIZE / 512)  // disk sectors per block
 
 // File system super block
 struct superblock {
   uint size;         // Size of file system image (blocks)
   uint nblocks;      // Number of data blocks
   uint ninodes;      // Number of inodes.
+  uint stripe;       // RAID-0 chunk in sectors, 0 if not striped (see stripe.pl)
+  uint nlog;         // Number of log blocks, 0 if there is no log
+  uint logstart;     // First log block
+  uint bsize;        // Block size in bytes (0 means 512)
+};
+
+// A file's blocks are a list of extents, runs of consecutive
+// disk blocks, in file order.  The first NEXTENT are in the inode;
+// the rest are in a chain of extent blocks starting at extblk.
+// Each extent block holds NEXTBLK extents followed by the address
+// of the next extent block.  An extent of length 0 ends the list.
+struct extent {
+  uint start;           // First disk block
+  uint len;             // Number of blocks
 };
 
-#define NDIRECT 12
-#define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NEXTENT 6
+#define NEXTBLK (BSIZE / sizeof(struct extent) - 1)
+#define MAXFILE 16384   // blocks; a limit on writes, not on extents
+
+// A file or directory that has no blocks (ext[0].len == 0)
+// keeps its contents, at most NINLINE bytes, in the inode, so
+// reading a small file reads only its inode's block.
+#define NINLINE 192
 
 // On-disk inode structure
 struct dinode {
@@ -26,7 +52,9 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  struct extent ext[NEXTENT];  // First extents of the file
+  uint extblk;          // Block holding more extents, or 0
+  uchar inl[NINLINE];   // Contents, if there are no blocks
 };
 
 // Inodes per block.
@@ -49,3 +77,54 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A hashed directory holds names of up to MAXNAME bytes.
+// Block 0 is a struct dirhead.  Each bucket is a chain of blocks
+// that start with the number (within the directory) of the next
+// block in the chain, 0 at the end, followed by hdirents filling
+// the rest of the block.  An hdirent with inum 0 is free space.
+// Chains may share their tails: a name is looked for in every
+// block of its bucket's chain, whatever the other names there.
+// The magic number tells it from an array of dirents, which
+// always starts with a dirent for "." with inum != 0.
+//
+// A new directory starts out in its inode instead: its size is
+// NINLINE, and inl holds DIRINLINE followed by hdirents filling
+// the rest.  When a name does not fit, the directory becomes
+// hashed, with every bucket's chain starting at block 1, which
+// holds the entries that were in the inode.
+#define MAXNAME 255
+#define DIRMAGIC 0x48440000
+#define DIRINLINE 0x48490000
+// There are as many hash buckets as make the first block of
+// every chain add up to 64 KB, so small directories stay small
+// with big blocks.
+#define NDIRHASH (65536 / BSIZE - 1)
+
+struct dirhead {
+  uint magic;
+  uint bucket[NDIRHASH];  // first block of each chain, or 0
+};
+
+struct hdirent {
+  ushort inum;
+  ushort reclen;          // bytes up to the next entry
+  ushort namelen;
+  char name[];            // not NUL-terminated
+};
+
+#define HDIRENTSIZE(n) ((sizeof(struct hdirent) + (n) + 3) & ~3)
+
+// A directory entry as getdents returns it, whatever the
+// directory's format, with the type and size of its inode.
+// Entries are packed one after another in the caller's buffer.
+struct dent {
+  uint inum;
+  uint size;
+  ushort reclen;          // bytes up to the next entry
+  uchar type;
+  uchar namelen;
+  char name[];            // NUL-terminated
+};
+
+#define DENTSIZE(n) ((sizeof(struct dent) + (n) + 1 + 3) & ~3)
+
@@ -0,0 +1,98 @@
+// File system write amplification benchmark.
+// Creates, appends to, overwrites, reads and deletes a file,
+// and reports how many disk sectors each step reads and writes
+// (from iostat) against how many blocks of data it moved, and
+// how often it found file pages in the page cache.
+// Each step ends with sync, so delayed writes are counted.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+#define NBLOCK 512  // blocks in the test file
+
+char buf[4096];  // the size the reports below give
+struct iostat st0;
+
+void
+start(void)
+{
+  sync();
+  iostat(&st0);
+}
+
+void
+report(char *step, int nblock)
+{
+  struct iostat st;
+
+  sync();
+  iostat(&st);
+  printf(1, "%s: %d data blocks, %d sectors written, %d read, "
+         "%d page hits, %d misses\n",
+         step, nblock, st.nwrite - st0.nwrite, st.nread - st0.nread,
+         st.pghit - st0.pghit, st.pgmiss - st0.pgmiss);
+}
+
+// Write NBLOCK blocks to fd in n-byte writes.
+void
+fill(int fd, int n)
+{
+  int i;
+
+  for(i = 0; i < NBLOCK*BSIZE; i += n){
+    memset(buf, i / n, n);
+    if(write(fd, buf, n) != n){
+      printf(1, "fsbench: write failed\n");
+      exit();
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd;
+
+  unlink("fsbench.tmp");
+
+  start();
+  if((fd = open("fsbench.tmp", O_CREATE|O_RDWR)) < 0){
+    printf(1, "fsbench: cannot create fsbench.tmp\n");
+    exit();
+  }
+  fill(fd, sizeof(buf));
+  close(fd);
+  report("create, 4096-byte writes", NBLOCK);
+
+  start();
+  fd = open("fsbench.tmp", O_RDWR);
+  fill(fd, sizeof(buf));
+  close(fd);
+  report("overwrite, 4096-byte writes", NBLOCK);
+
+  start();
+  fd = open("fsbench.tmp", O_RDONLY);
+  while(read(fd, buf, sizeof(buf)) > 0)
+    ;
+  close(fd);
+  report("read, 4096-byte reads", NBLOCK);
+
+  start();
+  unlink("fsbench.tmp");
+  report("delete", 0);
+
+  start();
+  fd = open("fsbench.tmp", O_CREATE|O_RDWR);
+  fill(fd, 128);
+  close(fd);
+  report("create, 128-byte writes", NBLOCK);
+
+  start();
+  unlink("fsbench.tmp");
+  report("delete", 0);
+
+  exit();
+}
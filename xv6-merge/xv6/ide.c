@@ -1,4 +1,9 @@
 // Simple PIO-based (non-DMA) IDE driver code.
+//
+// Disks 0 and 1 are the master and slave on the primary channel,
+// disk 2 is the master on the secondary channel.  The two channels
+// have their own registers, interrupt and request queue, so they
+// transfer data at the same time.
 
 #include "types.h"
 #include "defs.h"
@@ -13,34 +18,78 @@
 #define IDE_BSY       0x80
 #define IDE_DRDY      0x40
 #define IDE_DF        0x20
+#define IDE_DRQ       0x08
 #define IDE_ERR       0x01
 
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
-
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
+#define IDE_CMD_IDENTIFY 0xec
+
+#define NIDECHAN 2
+
+// Per channel: command block and control registers.
+static struct {
+  ushort base;
+  ushort ctl;
+} idechan[NIDECHAN] = {
+  { 0x1f0, 0x3f6 },
+  { 0x170, 0x376 },
+};
+
+#define IDECHAN(dev)  (((dev)>>1) & 1)
+
+// idequeue[c] points to the buf now being read/written to the
+// disk on channel c.  idequeue[c]->qnext points to the next buf
+// to be processed.  A buf may span several sectors; the disk
+// interrupts once per sector, and idedone[c] counts the sectors
+// of idequeue[c] transferred so far.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
-static struct buf *idequeue;
+static struct buf *idequeue[NIDECHAN];
+static int idedone[NIDECHAN];
 
-static int havedisk1;
+static int havedisk[3];
 static void idestart(struct buf*);
 
-// Wait for IDE disk to become ready.
+// Wait for IDE disk on channel c to become ready.
 static int
-idewait(int checkerr)
+idewait(int c, int checkerr)
 {
   int r;
 
-  while(((r = inb(0x1f7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY) 
+  while(((r = inb(idechan[c].base+7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
     ;
   if(checkerr && (r & (IDE_DF|IDE_ERR)) != 0)
     return -1;
   return 0;
 }
 
+// Is there an ATA disk at dev?  Asks the drive to identify
+// itself, which an empty or floating channel and an ATAPI
+// drive (e.g. QEMU's default CD-ROM) will not do.
+static int
+ideprobe(int dev)
+{
+  int c, i, r;
+  uint id[128];
+
+  c = IDECHAN(dev);
+  outb(idechan[c].ctl, 2);  // no interrupts while probing
+  outb(idechan[c].base+6, 0xe0 | ((dev&1)<<4));
+  outb(idechan[c].base+7, IDE_CMD_IDENTIFY);
+  for(i = 0; i < 100000; i++){
+    r = inb(idechan[c].base+7);
+    if(r == 0 || r == 0xff || (r & IDE_ERR))
+      break;
+    if((r & (IDE_BSY|IDE_DRQ)) == IDE_DRQ){
+      insl(idechan[c].base, id, 512/4);
+      return 1;
+    }
+  }
+  return 0;
+}
+
 void
 ideinit(void)
 {
@@ -49,105 +98,153 @@ ideinit(void)
   initlock(&idelock, "ide");
   picenable(IRQ_IDE);
   ioapicenable(IRQ_IDE, ncpu - 1);
-  idewait(0);
-  
+  idewait(0, 0);
+
   // Check if disk 1 is present
   outb(0x1f6, 0xe0 | (1<<4));
   for(i=0; i<1000; i++){
     if(inb(0x1f7) != 0){
-      havedisk1 = 1;
+      havedisk[1] = 1;
       break;
     }
   }
-  
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  // Check for disk 2, on the secondary channel.
+  if(ideprobe(2)){
+    havedisk[2] = 1;
+    picenable(IRQ_IDE2);
+    ioapicenable(IRQ_IDE2, ncpu - 1);
+  }
+}
+
+// Is IDE disk dev present?
+int
+idedisk(int dev)
+{
+  return dev == 0 || (dev < NELEM(havedisk) && havedisk[dev]);
 }
 
 // Start the request for b.  Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  ushort base;
+
   if(b == 0)
     panic("idestart");
-
-  idewait(0);
-  outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, 1);  // number of sectors
-  outb(0x1f3, b->sector & 0xff);
-  outb(0x1f4, (b->sector >> 8) & 0xff);
-  outb(0x1f5, (b->sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((b->sector>>24)&0x0f));
+  if(b->nsect < 1 || b->nsect > 255)
+    panic("idestart: nsect");
+
+  base = idechan[IDECHAN(b->dev)].base;
+  idewait(IDECHAN(b->dev), 0);
+  outb(idechan[IDECHAN(b->dev)].ctl, 0);  // generate interrupt
+  outb(base+2, b->nsect);  // number of sectors
+  outb(base+3, b->sector & 0xff);
+  outb(base+4, (b->sector >> 8) & 0xff);
+  outb(base+5, (b->sector >> 16) & 0xff);
+  outb(base+6, 0xe0 | ((b->dev&1)<<4) | ((b->sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
-    outb(0x1f7, IDE_CMD_WRITE);
-    outsl(0x1f0, b->data, 512/4);
+    outb(base+7, IDE_CMD_WRITE);
+    outsl(base, b->data, 512/4);
   } else {
-    outb(0x1f7, IDE_CMD_READ);
+    outb(base+7, IDE_CMD_READ);
   }
+  idedone[IDECHAN(b->dev)] = 0;
 }
 
-// Interrupt handler.
+// Interrupt handler for channel c.
 void
-ideintr(void)
+ideintr(int c)
 {
   struct buf *b;
 
   // Take first buffer off queue.
   acquire(&idelock);
-  if((b = idequeue) == 0){
+  if((b = idequeue[c]) == 0){
     release(&idelock);
     cprintf("Spurious IDE interrupt.\n");
     return;
   }
-  idequeue = b->qnext;
 
   // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, 512/4);
-  
+  if(!(b->flags & B_DIRTY) && idewait(c, 1) >= 0)
+    insl(idechan[c].base, b->data + idedone[c]*512, 512/4);
+
+  // More sectors to go: a read waits for the next one,
+  // a write sends it.
+  if(++idedone[c] < b->nsect){
+    if(b->flags & B_DIRTY){
+      idewait(c, 0);
+      outsl(idechan[c].base, b->data + idedone[c]*512, 512/4);
+    }
+    release(&idelock);
+    return;
+  }
+  idequeue[c] = b->qnext;
+
   // Wake process waiting for this buf.
   b->flags |= B_VALID;
   b->flags &= ~B_DIRTY;
   wakeup(b);
-  
+
   // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  if(idequeue[c] != 0)
+    idestart(idequeue[c]);
 
   release(&idelock);
 }
 
-// Sync buf with disk. 
+// Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
 void
 iderw(struct buf *b)
 {
-  struct buf **pp;
+  iderwv(&b, 1);
+}
 
-  if(!(b->flags & B_BUSY))
-    panic("iderw: buf not busy");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
-  if(b->dev != 0 && !havedisk1)
-    panic("idrw: ide disk 1 not present");
+// Sync n bufs with disk, as iderw does.  All of them are queued
+// before waiting, so the disk goes from one to the next without
+// a round trip through the scheduler, and disks on different
+// channels work in parallel.
+void
+iderwv(struct buf **bv, int n)
+{
+  struct buf **pp, *b;
+  int i, c;
 
   acquire(&idelock);
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)
-    ;
-  *pp = b;
-  
-  // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
-  
-  // Wait for request to finish.
+  for(i = 0; i < n; i++){
+    b = bv[i];
+    if(!(b->flags & B_BUSY))
+      panic("iderw: buf not busy");
+    if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+      panic("iderw: nothing to do");
+    if(!idedisk(b->dev))
+      panic("idrw: ide disk not present");
+
+    // Append b to its channel's queue.
+    c = IDECHAN(b->dev);
+    b->qnext = 0;
+    for(pp=&idequeue[c]; *pp; pp=&(*pp)->qnext)
+      ;
+    *pp = b;
+
+    // Start disk if necessary.
+    if(idequeue[c] == b)
+      idestart(b);
+  }
+
+  // Wait for requests to finish.
   // Assuming will not sleep too long: ignore proc->killed.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID) {
-    sleep(b, &idelock);
+  for(i = 0; i < n; i++){
+    b = bv[i];
+    while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+      sleep(b, &idelock);
   }
 
   release(&idelock);
@@ -0,0 +1,413 @@
+// Submission and completion rings.
+//
+// A process puts a struct ioring (see ioring.h) in a page of
+// its memory and registers it with ioring_setup.  It fills in
+// submission entries, advances sqtail, and calls ioring_enter,
+// which hands all the new entries to the kernel in one system
+// call and returns, waiting only if asked for completions.
+//
+// The entries are carried out by ioworker, a kernel process,
+// in order for each ring.  It reaches the process's buffers
+// through the process's page table, a page at a time, and
+// waits for the disk like any reader or writer: the disk
+// interrupt wakes it, and it posts the completion and wakes
+// the process.  An entry that would wait, a read of an empty
+// pipe or a poll for an event that has not happened, does not
+// hold up the rest: it is kept and tried again after each
+// pollwakeup (see file.c).  One worker serves all rings, so
+// a process's disk waits overlap its own computing, not one
+// another.
+//
+// The kernel reaches the ring through its page's kernel
+// address, with a reference to the page, so the ring stays
+// valid whatever the process does with its memory.  It keeps
+// its own sqhead and cqtail, and checks the indexes the
+// process writes, so a bad ring costs at most one ring's work.
+// A process that frees memory first pauses its ring, so the
+// worker is never inside a buffer being freed.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "ioring.h"
+
+struct ioent {
+  struct iosqe e;
+  struct file *f;                  // e's file, or 0
+};
+
+struct ioctx {
+  struct ioctx *next;              // on ioq.list
+  struct proc *p;                  // the process owning the ring
+  char *page;                      // page holding the ring
+  struct ioring *ring;             // kernel address of the ring
+  uint sqhead;                     // the kernel's indexes, copied
+  uint cqtail;                     //   to the ring
+  int busy;                        // ioworker is carrying out entries
+  int paused;                      // ioworker must leave the ring alone
+  int nq;                          // entries taken but not complete
+  struct ioent q[IORING_NSQ];
+};
+
+// The registered rings.  The lock guards each ring's
+// cqtail, busy, paused, nq and q.
+static struct {
+  struct spinlock lock;
+  struct ioctx *list;
+  int nq;                          // entries of all rings
+} ioq;
+
+// Read or write e's buffer in the process's memory into or
+// out of f a page at a time, as one read or write.
+static int
+iorw(struct ioctx *io, struct iosqe *e, struct file *f)
+{
+  uint a;
+  int n, m, tot;
+  char *ka;
+
+  for(tot = 0; tot < e->len; tot += m){
+    a = (uint)e->addr + tot;
+    n = PGSIZE - a % PGSIZE;
+    if(n > e->len - tot)
+      n = e->len - tot;
+    // The process may have shrunk since it submitted e.
+    if(a + n > io->p->sz ||
+       (ka = uva2ka(io->p->pgdir, (char*)(a - a % PGSIZE))) == 0)
+      return tot ? tot : -1;
+    ka += a % PGSIZE;
+    if(e->off >= 0){
+      if(e->op == IOR_READ)
+        m = filepread(f, ka, n, e->off + tot);
+      else
+        m = filepwrite(f, ka, n, e->off + tot);
+    } else if(f->type == FD_PIPE){
+      if(e->op == IOR_READ)
+        m = piperead(f->pipe, ka, n, 1);
+      else
+        m = pipewrite(f->pipe, ka, n, 1);
+    } else if(e->op == IOR_READ)
+      m = fileread(f, ka, n);
+    else
+      m = filewrite(f, ka, n);
+    if(m < 0)
+      return tot ? tot : m;
+    if(m < n)
+      return tot + m;
+  }
+  return tot;
+}
+
+// Carry out entry q of io, setting *res to its result.
+// Returns 1 instead if it must wait for its file to be ready.
+static int
+iorun(struct ioctx *io, struct ioent *q, int *res)
+{
+  struct iosqe *e;
+  struct file *f;
+  int ev;
+
+  e = &q->e;
+  f = q->f;
+  *res = -1;
+  switch(e->op){
+  case IOR_NOP:
+    *res = 0;
+    return 0;
+
+  case IOR_READ:
+  case IOR_WRITE:
+    if(e->off >= 0){
+      *res = iorw(io, e, f);
+      return 0;
+    }
+    // Only ever wait in pollsleep: the worker must not
+    // block in a pipe or device on one ring's behalf.
+    ev = filepoll(f);
+    if(e->op == IOR_READ && !(ev & (POLLIN|POLLHUP)))
+      return 1;
+    if(e->op == IOR_WRITE && !(ev & (POLLOUT|POLLERR)))
+      return 1;
+    if(e->op == IOR_WRITE && (ev & POLLERR))
+      return 0;
+    *res = iorw(io, e, f);
+    // Another process may have emptied or filled the pipe
+    // since it was polled.
+    return *res < 0 && f->type == FD_PIPE;
+
+  case IOR_FSYNC:
+    log_sync();
+    pcsync();
+    *res = 0;
+    return 0;
+
+  case IOR_POLL:
+    if((*res = filepoll(f) & (e->events | POLLHUP | POLLERR)) == 0)
+      return 1;
+    return 0;
+  }
+  return 0;
+}
+
+// Post a completion for the submission with data.
+// Caller holds ioq.lock.
+static void
+iopost(struct ioctx *io, uint data, int res)
+{
+  struct iocqe *c;
+
+  c = &io->ring->cq[io->cqtail % IORING_NCQ];
+  c->data = data;
+  c->res = res;
+  io->ring->cqtail = ++io->cqtail;
+}
+
+// Try each entry of io that is not yet complete, posting
+// those that finish.  Returns the number posted.
+// Called by ioworker, with io->busy set.
+static int
+iowork(struct ioctx *io)
+{
+  struct ioent *q;
+  struct file *f;
+  int i, n, res;
+
+  // ioring_enter only adds entries at the end of io->q,
+  // so q stays put while the lock is not held.
+  n = 0;
+  acquire(&ioq.lock);
+  for(i = 0; i < io->nq; ){
+    q = &io->q[i];
+    release(&ioq.lock);
+    if(iorun(io, q, &res)){
+      acquire(&ioq.lock);
+      i++;
+      continue;
+    }
+    f = q->f;
+    acquire(&ioq.lock);
+    iopost(io, q->e.data, res);
+    memmove(q, q + 1, (io->nq - i - 1) * sizeof(*q));
+    io->nq--;
+    ioq.nq--;
+    n++;
+    wakeup(io);
+    if(f){
+      release(&ioq.lock);
+      fileclose(f);
+      acquire(&ioq.lock);
+    }
+  }
+  release(&ioq.lock);
+  return n;
+}
+
+// The I/O worker: carry out the rings' entries, and sleep
+// until a pollwakeup when none can go on.  It polls only
+// while there are entries, so as not to slow pollwakeup.
+static void
+ioworker(void)
+{
+  struct ioctx *io;
+  uint seq;
+  int n;
+
+  for(;;){
+    acquire(&ioq.lock);
+    while(ioq.nq == 0)
+      sleep(&ioq, &ioq.lock);
+    release(&ioq.lock);
+    seq = pollstart();
+    n = 0;
+    acquire(&ioq.lock);
+    for(io = ioq.list; io; io = io->next){
+      if(io->paused || io->nq == 0)
+        continue;
+      io->busy = 1;
+      release(&ioq.lock);
+      n += iowork(io);
+      acquire(&ioq.lock);
+      io->busy = 0;
+      if(io->paused)
+        wakeup(&io->busy);
+    }
+    release(&ioq.lock);
+    if(n == 0)
+      pollsleep(seq, 0, 0);
+    pollstop();
+  }
+}
+
+void
+ioringinit(void)
+{
+  initlock(&ioq.lock, "ioring");
+  kproc("ioworker", ioworker);
+}
+
+// Keep ioworker out of the process's ring, waiting for any
+// entry it is carrying out, so that its memory can shrink.
+void
+ioringpause(void)
+{
+  struct ioctx *io;
+
+  if((io = proc->io) == 0)
+    return;
+  acquire(&ioq.lock);
+  io->paused = 1;
+  while(io->busy)
+    sleep(&io->busy, &ioq.lock);
+  release(&ioq.lock);
+}
+
+void
+ioringresume(void)
+{
+  if(proc->io == 0)
+    return;
+  acquire(&ioq.lock);
+  proc->io->paused = 0;
+  release(&ioq.lock);
+  pollwakeup();
+}
+
+// Drop the process's ring, and any entries not yet complete.
+void
+ioringfree(void)
+{
+  struct ioctx *io, **pp;
+  int i;
+
+  if((io = proc->io) == 0)
+    return;
+  ioringpause();
+  acquire(&ioq.lock);
+  for(pp = &ioq.list; *pp != io; pp = &(*pp)->next)
+    ;
+  *pp = io->next;
+  ioq.nq -= io->nq;
+  release(&ioq.lock);
+  for(i = 0; i < io->nq; i++)
+    if(io->q[i].f)
+      fileclose(io->q[i].f);
+  kfree(io->page);
+  kfree((char*)io);
+  proc->io = 0;
+}
+
+// Register the rings at addr, which must not cross a page,
+// in place of any the process had, and empty them.
+int
+sys_ioring_setup(void)
+{
+  struct ioctx *io;
+  char *p, *page;
+  uint off;
+
+  if(argptr(0, &p, sizeof(struct ioring)) < 0)
+    return -1;
+  off = (uint)p % PGSIZE;
+  if(off + sizeof(struct ioring) > PGSIZE)
+    return -1;
+  if((page = uva2ka(proc->pgdir, p - off)) == 0)
+    return -1;
+  if((io = (struct ioctx*)kalloc()) == 0)
+    return -1;
+  ioringfree();
+  kdup(page);
+  memset(io, 0, sizeof(*io));
+  io->p = proc;
+  io->page = page;
+  io->ring = (struct ioring*)(page + off);
+  memset(io->ring, 0, sizeof(struct ioring));
+  acquire(&ioq.lock);
+  io->next = ioq.list;
+  ioq.list = io;
+  release(&ioq.lock);
+  proc->io = io;
+  return 0;
+}
+
+// Check submission e and find its file.
+// Returns 0 if e is bad, leaving *fp alone.
+static int
+iotake(struct iosqe *e, struct file **fp)
+{
+  struct file *f;
+
+  if(e->op == IOR_NOP)
+    return 1;
+  if(e->op != IOR_READ && e->op != IOR_WRITE &&
+     e->op != IOR_FSYNC && e->op != IOR_POLL)
+    return 0;
+  if((f = fdget(e->fd)) == 0)
+    return 0;
+  if(e->op == IOR_READ || e->op == IOR_WRITE){
+    if(e->len < 0 || (uint)e->addr >= proc->sz ||
+       e->len > proc->sz - (uint)e->addr)
+      return 0;
+    if(e->op == IOR_READ ? f->readable == 0 : f->writable == 0)
+      return 0;
+    if(e->off >= 0 && f->type != FD_INODE)
+      return 0;
+  }
+  *fp = filedup(f);
+  return 1;
+}
+
+// Hand the submissions added since the last call to
+// ioworker, as many as there is room to complete, then wait
+// until at least want completions are unread or no entry is
+// left.  Returns the number of submissions taken.
+int
+sys_ioring_enter(void)
+{
+  struct ioctx *io;
+  struct ioring *r;
+  struct ioent q;
+  int want, n;
+  uint sqtail, cqhead;
+
+  if(argint(0, &want) < 0 || (io = proc->io) == 0)
+    return -1;
+  r = io->ring;
+  sqtail = r->sqtail;
+  cqhead = r->cqhead;
+  acquire(&ioq.lock);
+  if(sqtail - io->sqhead > IORING_NSQ || io->cqtail - cqhead > IORING_NCQ){
+    release(&ioq.lock);
+    return -1;
+  }
+  for(n = 0; io->sqhead != sqtail && io->nq < IORING_NSQ &&
+      io->cqtail - cqhead + io->nq < IORING_NCQ; n++){
+    q.e = r->sq[io->sqhead % IORING_NSQ];
+    q.f = 0;
+    r->sqhead = ++io->sqhead;
+    release(&ioq.lock);
+    if(iotake(&q.e, &q.f)){
+      acquire(&ioq.lock);
+      io->q[io->nq++] = q;
+      ioq.nq++;
+    } else {
+      acquire(&ioq.lock);
+      iopost(io, q.e.data, -1);
+    }
+  }
+  if(n > 0)
+    wakeup(&ioq);
+  release(&ioq.lock);
+  if(n > 0)
+    pollwakeup();
+  acquire(&ioq.lock);
+  while(io->nq > 0 && (int)(io->cqtail - cqhead) < want && !proc->killed)
+    sleep(io, &ioq.lock);
+  release(&ioq.lock);
+  return proc->killed ? -1 : n;
+}
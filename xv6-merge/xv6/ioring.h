@@ -0,0 +1,42 @@
+// Submission and completion rings for ioring_enter.
+// Both the kernel and user programs use this header file.
+//
+// The process owns sqtail and cqhead; the kernel owns sqhead
+// and cqtail.  Indexes run freely and are taken modulo the
+// ring sizes.
+
+#define IORING_NSQ 32   // submission entries
+#define IORING_NCQ 64   // completion entries
+
+// Operations.
+#define IOR_NOP   0
+#define IOR_READ  1     // read len bytes into addr
+#define IOR_WRITE 2     // write len bytes from addr
+#define IOR_FSYNC 3     // as fsync
+#define IOR_POLL  4     // wait for events; the result is revents
+
+struct iosqe {
+  uchar op;
+  uchar pad;
+  short events;         // for IOR_POLL
+  int fd;
+  void *addr;
+  int len;
+  int off;              // offset as for pread, or -1 to use the file's
+  uint data;            // copied to the completion
+};
+
+struct iocqe {
+  uint data;            // from the submission
+  int res;              // what the system call would return
+};
+
+// The rings, which must lie in one page of the process.
+struct ioring {
+  uint sqhead;
+  uint sqtail;
+  uint cqhead;
+  uint cqtail;
+  struct iosqe sq[IORING_NSQ];
+  struct iocqe cq[IORING_NCQ];
+};
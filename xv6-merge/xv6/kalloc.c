@@ -1,6 +1,11 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
 // and pipe buffers. Allocates 4096-byte pages.
+//
+// A page may have several owners: a page of the file page cache
+// or of a process that splice or vmsplice put in a pipe is also
+// the pipe's.  kdup adds an owner, and kfree frees the page only
+// when the last one lets go.
 
 #include "types.h"
 #include "defs.h"
@@ -15,6 +20,7 @@ struct run {
 struct {
   struct spinlock lock;
   struct run *freelist;
+  ushort ref[PHYSTOP/PGSIZE];  // owners of each allocated page
 } kmem;
 
 // Initialize free list of physical pages.
@@ -41,6 +47,15 @@ kfree(char *v)
   if(((uint) v) % PGSIZE || (uint)v < 1024*1024 || (uint)v >= PHYSTOP) 
     panic("kfree");
 
+  acquire(&kmem.lock);
+  if(kmem.ref[(uint)v/PGSIZE] > 1){
+    kmem.ref[(uint)v/PGSIZE]--;
+    release(&kmem.lock);
+    return;
+  }
+  kmem.ref[(uint)v/PGSIZE] = 0;
+  release(&kmem.lock);
+
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
@@ -54,16 +69,45 @@ kfree(char *v)
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// When none is free, it takes back memory that the file
+// page cache can do without.
 char*
 kalloc()
 {
   struct run *r;
 
+  do {
+    acquire(&kmem.lock);
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      kmem.ref[(uint)r/PGSIZE] = 1;
+    }
+    release(&kmem.lock);
+  } while(r == 0 && pcreclaim());
+  return (char*) r;
+}
+
+// Add an owner to the allocated page v; kfree must be
+// called once more before it is freed.
+void
+kdup(char *v)
+{
   acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  if(kmem.ref[(uint)v/PGSIZE] < 1)
+    panic("kdup");
+  kmem.ref[(uint)v/PGSIZE]++;
   release(&kmem.lock);
-  return (char*) r;
 }
 
+// How many owners does the allocated page v have?
+int
+kref(char *v)
+{
+  int n;
+
+  acquire(&kmem.lock);
+  n = kmem.ref[(uint)v/PGSIZE];
+  release(&kmem.lock);
+  return n;
+}
@@ -0,0 +1,296 @@
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "buf.h"
+
+// Write-ahead log of file system metadata, with group commit.
+//
+// A system call that changes the file system brackets its
+// changes with begin_op() and end_op(), and writes metadata
+// blocks (inodes, bitmap, directories, extent blocks) with
+// log_write() instead of bwrite().  log_write only pins the
+// buffer in the cache and adds its block number to the running
+// transaction, so a block written by many system calls appears
+// in the transaction once.  The transaction is not committed
+// when a call finishes, but when it may not have room for the
+// next one, when someone asks (log_sync, from sync and fsync),
+// or every FLUSHTICKS by the buffer flusher; so concurrent and
+// consecutive calls share one commit, and every commit is two
+// sequential writes: the blocks, then the header.
+//
+// File contents are not logged.  They are written back like any
+// delayed write, but a commit writes back all of them first, so
+// a committed inode never points at data that is not on disk.
+// A block freed by a transaction is not reused until it commits
+// (see bfree in fs.c), so no one writes over it while a crash
+// could still bring back the file it belonged to.
+//
+// The log is a header block followed by two halves of LOGSIZE
+// blocks, which commits use in turn.  The header holds the
+// block numbers of the last committed transaction and which half
+// holds their contents; writing it is the commit point.  Once
+// committed, the blocks are checkpointed lazily: they are
+// written home by the buffer flusher like other delayed writes.
+// The next commit writes home whatever of them is still dirty
+// before its header replaces this one, so the blocks of all
+// but the last transaction are always home.  After a crash,
+// initlog copies the last transaction's half home again.
+
+// Contents of the header block.
+struct logheader {
+  uint n;
+  uint half;
+  uint block[LOGSIZE];
+};
+
+struct {
+  struct spinlock lock;
+  uint dev;
+  uint start;       // header block
+  uint size;        // blocks per half; 0 if there is no log
+  uint half;        // half the next commit writes
+  int outstanding;  // how many FS sys calls are executing
+  int committing;   // in commit(), please wait
+  int syncing;      // someone waits in log_sync
+  int n;            // blocks in the running transaction
+  uint block[LOGSIZE];
+} log;
+
+// Private buffers for the header and for writing a transaction.
+static struct buf logbuf[LOGSIZE+1];
+static struct buf *logbv[LOGSIZE+1];
+static uchar logdata[LOGSIZE+1][BSIZE];
+
+static void commit(void);
+
+// Point logbuf[i] at log block lb, to be written if write.
+static struct buf*
+logblock(int i, uint lb, int write)
+{
+  struct buf *b;
+
+  b = &logbuf[i];
+  b->dev = log.dev;
+  b->blockno = lb;
+  b->nsect = SPB;
+  b->data = logdata[i];
+  b->flags = B_BUSY | (write ? B_DIRTY : 0);
+  logbv[i] = b;
+  return b;
+}
+
+static void
+writehead(int n)
+{
+  struct buf *b;
+  struct logheader *lh;
+  int i;
+
+  b = logblock(0, log.start, 1);
+  lh = (struct logheader*)b->data;
+  lh->n = n;
+  lh->half = log.half;
+  for(i = 0; i < n; i++)
+    lh->block[i] = log.block[i];
+  bdirect(logbv, 1);
+}
+
+// Copy the transaction in the log, if any, to its home
+// locations, and empty the log.
+static void
+recover(void)
+{
+  struct buf *b, *hb;
+  struct logheader lh;
+  int i;
+
+  hb = logblock(0, log.start, 0);
+  bdirect(logbv, 1);
+  memmove(&lh, hb->data, sizeof(lh));
+  if(lh.n == 0)
+    return;
+  if(lh.n > log.size || lh.half > 1)
+    panic("recover: bad log header");
+
+  for(i = 0; i < lh.n; i++)
+    logblock(i, log.start + 1 + lh.half*log.size + i, 0);
+  bdirect(logbv, lh.n);
+  for(i = 0; i < lh.n; i++){
+    b = bread(log.dev, lh.block[i]);
+    memmove(b->data, logbuf[i].data, BSIZE);
+    bwrite(b);
+    brelse(b);
+  }
+  bsync();
+  writehead(0);
+}
+
+// Set up the log of the file system on dev, described by sb,
+// and recover from a crash.  Called by fsinit.
+void
+initlog(int dev, struct superblock *sb)
+{
+  if(sizeof(struct logheader) > BSIZE)
+    panic("initlog: too big logheader");
+
+  initlock(&log.lock, "log");
+  if(sb->nlog == 0)
+    return;
+  if((sb->nlog - 1) / 2 < MAXOPBLOCKS)
+    panic("initlog: log too small");
+  log.dev = dev;
+  log.start = sb->logstart;
+  log.size = (sb->nlog - 1) / 2;
+  if(log.size > LOGSIZE)
+    log.size = LOGSIZE;
+  recover();
+}
+
+// Commit the running transaction.  Called with log.lock held,
+// no FS sys call executing and nobody committing.
+static void
+docommit(void)
+{
+  log.committing = 1;
+  release(&log.lock);
+  commit();
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+}
+
+// Called at the start of each FS system call.
+void
+begin_op(void)
+{
+  if(log.size == 0)
+    return;
+  acquire(&log.lock);
+  for(;;){
+    if(log.committing || log.syncing){
+      sleep(&log, &log.lock);
+    } else if(log.n + (log.outstanding+1)*MAXOPBLOCKS > log.size ||
+              bfreelow(log.outstanding+1)){
+      // This op might exhaust the transaction, or need blocks
+      // it has freed; commit first.
+      if(log.outstanding == 0)
+        docommit();
+      else
+        sleep(&log, &log.lock);
+    } else {
+      log.outstanding++;
+      break;
+    }
+  }
+  release(&log.lock);
+}
+
+// Called at the end of each FS system call.
+// Commits only if the next call might not fit.
+void
+end_op(void)
+{
+  if(log.size == 0)
+    return;
+  acquire(&log.lock);
+  log.outstanding--;
+  if(log.committing)
+    panic("log.committing");
+  if(log.outstanding == 0 && !log.syncing &&
+     log.n + MAXOPBLOCKS > log.size)
+    docommit();
+  else
+    wakeup(&log);  // begin_op may be waiting for log space.
+  release(&log.lock);
+}
+
+// Commit the running transaction, if it holds anything, once
+// the FS system calls now executing have finished.  New ones
+// wait until it is done.  Everything written before the call
+// is on disk, or in the log, when it returns.
+void
+log_sync(void)
+{
+  if(log.size == 0)
+    return;
+  acquire(&log.lock);
+  log.syncing++;
+  while(log.committing || log.outstanding > 0)
+    sleep(&log, &log.lock);
+  log.syncing--;
+  if(log.n > 0)
+    docommit();
+  else
+    wakeup(&log);
+  release(&log.lock);
+}
+
+static void
+commit(void)
+{
+  struct buf *b;
+  int i;
+
+  if(log.n == 0)
+    return;
+
+  // Write home file data and the blocks of the last commit.
+  pcsync();
+  bsync();
+
+  for(i = 0; i < log.n; i++){
+    b = bread(log.dev, log.block[i]);
+    memmove(logblock(i, log.start + 1 + log.half*log.size + i, 1)->data,
+            b->data, BSIZE);
+    brelse(b);
+  }
+  bdirect(logbv, log.n);
+  writehead(log.n);  // the real commit
+
+  for(i = 0; i < log.n; i++){
+    b = bread(log.dev, log.block[i]);
+    bunpin(b);
+    brelse(b);
+  }
+  log.half ^= 1;
+  log.n = 0;
+  bfreecommit();
+}
+
+// Caller has modified b->data and is done with the buffer.
+// Add the block to the running transaction and pin it in the
+// cache; it is written to the log when the transaction commits,
+// and home after that.  log_write() replaces bwrite(); a
+// typical use is:
+//   bp = bread(...)
+//   modify bp->data[]
+//   log_write(bp)
+//   brelse(bp)
+// Without a log, it is just bwrite.
+void
+log_write(struct buf *b)
+{
+  int i;
+
+  if(log.size == 0){
+    bwrite(b);
+    return;
+  }
+  if(log.outstanding < 1)
+    panic("log_write outside of trans");
+
+  acquire(&log.lock);
+  for(i = 0; i < log.n; i++){
+    if(log.block[i] == b->blockno)  // log absorption
+      break;
+  }
+  if(i == log.n){
+    if(log.n >= log.size)
+      panic("too big a transaction");
+    log.block[log.n++] = b->blockno;
+  }
+  release(&log.lock);
+  bpin(b);
+}
@@ -22,12 +22,13 @@ fmtname(char *path)
   return buf;
 }
 
+char dbuf[BSIZE];
+
 void
 ls(char *path)
 {
-  char buf[512], *p;
-  int fd;
-  struct dirent de;
+  int fd, n, off;
+  struct dent *d;
   struct stat st;
   
   if((fd = open(path, 0)) < 0){
@@ -47,23 +48,12 @@ ls(char *path)
     break;
   
   case T_DIR:
-    if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf){
-      printf(1, "ls: path too long\n");
-      break;
-    }
-    strcpy(buf, path);
-    p = buf+strlen(buf);
-    *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf(1, "ls: cannot stat %s\n", buf);
-        continue;
+    // Each batch of entries comes with their types and sizes.
+    while((n = getdents(fd, dbuf, sizeof(dbuf))) > 0){
+      for(off = 0; off < n; off += d->reclen){
+        d = (struct dent*)(dbuf + off);
+        printf(1, "%s %d %d %d\n", fmtname(d->name), d->type, d->inum, d->size);
       }
-      printf(1, "%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
     }
     break;
   }
@@ -47,13 +47,17 @@ mainc(void)
   pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
+  pcinit();        // file page cache
   fileinit();      // file table
   iinit();         // inode cache
   ideinit();       // disk
+  virtioinit();    // virtio disk, if any
   soundinit();     // audio
   if(!ismp)
     timerinit();   // uniprocessor timer
   userinit();      // first user process
+  kproc("bflush", bflusher); // buffer cache write-back
+  ioringinit();    // ioring worker
   bootothers();    // start other processors
 
   // Finish setting up this processor in mpmain.
@@ -14,14 +14,14 @@
 
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 
-int nblocks = 1024 * 1024 - 3 - 256 - 26;
-
+int nblocks;
+int nlog = 1 + 2*LOGSIZE;  // header and two halves
 int ninodes = 200;
-int size = 1024 * 1024;
+int size = 512 * 1024 * 1024 / BSIZE;  // 512 MB
 
 int fsfd;
 struct superblock sb;
-char zeroes[512];
+char zeroes[BSIZE];
 uint freeblock;
 uint usedblocks;
 uint bitblocks;
@@ -34,6 +34,8 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirlink(uint dinum, char *name, uint inum);
+uint bmap(struct dinode*, uint);
 
 // convert to intel byte order
 ushort
@@ -63,10 +65,9 @@ main(int argc, char *argv[])
 {
   //test_file = fopen("wangxu", "w");
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
-  char buf[512];
-  struct dinode din;
+  uint rootino, inum;
+  struct dirhead *dh;
+  char buf[BSIZE];
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
@@ -76,8 +77,9 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  assert((512 % sizeof(struct dinode)) == 0);
-  assert((512 % sizeof(struct dirent)) == 0);
+  assert((BSIZE % sizeof(struct dinode)) == 0);
+  assert((BSIZE % sizeof(struct dirent)) == 0);
+  assert(BSIZE % 512 == 0 && sizeof(struct dirhead) <= BSIZE);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -85,17 +87,21 @@ main(int argc, char *argv[])
     exit(1);
   }
 
+  bitblocks = size/BPB + 1;
+  usedblocks = ninodes / IPB + 3 + bitblocks + nlog;
+  nblocks = size - usedblocks;
+  freeblock = usedblocks;
+
   sb.size = xint(size);
-  sb.nblocks = xint(nblocks); // so whole disk is size sectors
+  sb.nblocks = xint(nblocks); // so whole disk is size blocks
   sb.ninodes = xint(ninodes);
- // sb.nlog = xint(nlog);
-
-  bitblocks = size/(512*8) + 1;
-  usedblocks = ninodes / IPB + 3 + bitblocks;
-  freeblock = usedblocks;
+  sb.nlog = xint(nlog);
+  sb.logstart = xint(ninodes / IPB + 3 + bitblocks);
+  sb.bsize = xint(BSIZE);
 
-  printf("used %d (bit %d ninode %zu) free %u total %d\n", usedblocks,
-         bitblocks, ninodes/IPB + 1, freeblock,  nblocks+usedblocks);
+  printf("%d-byte blocks: used %d (bit %d ninode %zu log %d) free %u total %d\n",
+         BSIZE, usedblocks, bitblocks, ninodes/IPB + 1, nlog, freeblock,
+         nblocks+usedblocks);
 
   printf("%d\n", nblocks+usedblocks-size);
   assert(nblocks + usedblocks == size);
@@ -110,15 +116,13 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
+  bzero(buf, sizeof(buf));
+  dh = (struct dirhead*)buf;
+  dh->magic = xint(DIRMAGIC);
+  iappend(rootino, buf, BSIZE);
+  dirlink(rootino, ".", rootino);
+  dirlink(rootino, "..", rootino);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
   for(i = 2; i < argc; i++){
     assert(index(argv[i], '/') == 0);
 
@@ -136,10 +140,7 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, argv[i], DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    dirlink(rootino, argv[i], inum);
     while((cc = read(fd, buf, sizeof(buf))) > 0)
     {
       //printf("iappend... %d\n", cc);
@@ -148,13 +149,6 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
-
   balloc(usedblocks);
   exit(0);
 }
@@ -162,11 +156,11 @@ main(int argc, char *argv[])
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)BSIZE, 0) != sec * (long)BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(write(fsfd, buf, 512) != 512){
+  if(write(fsfd, buf, BSIZE) != BSIZE){
     perror("write");
     exit(1);
   }
@@ -181,7 +175,7 @@ i2b(uint inum)
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[BSIZE];
   uint bn;
   struct dinode *dip;
 
@@ -195,7 +189,7 @@ winode(uint inum, struct dinode *ip)
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[BSIZE];
   uint bn;
   struct dinode *dip;
 
@@ -208,11 +202,11 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)BSIZE, 0) != sec * (long)BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(read(fsfd, buf, 512) != 512){
+  if(read(fsfd, buf, BSIZE) != BSIZE){
     perror("read");
     exit(1);
   }
@@ -235,20 +229,20 @@ ialloc(ushort type)
 void
 balloc(int used)
 {
-  uchar buf[512];
+  uchar buf[BSIZE];
   int i, j = 0;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  //assert(used < 512*8);
+  // Each bitmap block describes BPB blocks.
   while(used > 0)
   {
-    bzero(buf, 512);
-    for(i = 0; i < used && i < 512; i++){
+    bzero(buf, sizeof(buf));
+    for(i = 0; i < used && i < BPB; i++){
       buf[i/8] = buf[i/8] | (0x1 << (i%8));
     }
-    used -= 512;
+    used -= BPB;
 
-    printf("%dballoc: write bitmap block at sector %zu\n", used,  ninodes/IPB + 3+j);
+    printf("%dballoc: write bitmap block at block %zu\n", used,  ninodes/IPB + 3+j);
     wsect(ninodes / IPB + 3 + j, buf);
     j ++;
   }
@@ -257,76 +251,96 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the block holding block fbn of the file, which must
+// exist or be just past the end.  Files are written one after
+// another, so a new block usually grows the last extent.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  struct extent e[NEXTBLK+1], *ep;
+  uint i, n, lblk, blk, next;
+
+  ep = din->ext;
+  n = NEXTENT;
+  blk = 0;
+  lblk = 0;
+  for(;;){
+    for(i = 0; i < n && xint(ep[i].len) > 0; i++){
+      if(fbn < lblk + xint(ep[i].len))
+        return xint(ep[i].start) + fbn - lblk;
+      lblk += xint(ep[i].len);
+    }
+    if(i < n)
+      break;
+    next = blk ? xint(e[NEXTBLK].start) : xint(din->extblk);
+    if(next == 0)
+      break;
+    rsect(next, e);
+    blk = next;
+    ep = e;
+    n = NEXTBLK;
+  }
+  assert(fbn == lblk);
+
+  if(i > 0 && xint(ep[i-1].start) + xint(ep[i-1].len) == freeblock){
+    ep[i-1].len = xint(xint(ep[i-1].len) + 1);
+  } else {
+    if(i == n){
+      next = freeblock++;
+      usedblocks++;
+      if(blk){
+        e[NEXTBLK].start = xint(next);
+        wsect(blk, e);
+      } else
+        din->extblk = xint(next);
+      bzero(e, sizeof(e));
+      blk = next;
+      ep = e;
+      i = 0;
+    }
+    ep[i].start = xint(freeblock);
+    ep[i].len = xint(1);
+  }
+  if(blk)
+    wsect(blk, e);
+  usedblocks++;
+  return freeblock++;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
   uint fbn, off, n1;
   struct dinode din;
-  char buf[512];
-  uint indirect[512];
+  char buf[BSIZE];
   uint x;
-  
+
   rinode(inum, &din);
-  
-  int temp_fbn, d1, d2, k1, k2, k3, a1, a2, a3;
   off = xint(din.size);
-  while(n > 0){
-    //printf("%d\n", n);
-    fbn = off / 512;
-    //assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      //printf("hjw 1 %d\n", n);
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-        usedblocks++;
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      
-      temp_fbn = fbn;
-      temp_fbn -= NDIRECT;
-      d1 = temp_fbn / 128;
-      k1 = temp_fbn % 128;
-      d2 = d1 / 128;
-      k2 = d1 % 128;
-      //d3 = d2 / 128;
-      k3 = d2 % 128;
-      if((a1 = din.addrs[NDIRECT]) == 0)
-      {
-	 a1 = din.addrs[NDIRECT] = xint(freeblock++);
-	 usedblocks ++;
-      }
-      rsect(xint(a1), (char*)indirect);
-      if((a2 = indirect[k3]) == 0)
-      {
-	a2 = indirect[k3] = xint(freeblock++);
-        usedblocks ++;
-        wsect(xint(a1), (char*)indirect);
-      }
-      rsect(xint(a2), (char*)indirect);
-      if((a3 = indirect[k2]) == 0)
-      {
-	a3 = indirect[k2] = xint(freeblock++);
-        usedblocks ++;
-        wsect(xint(a2), (char*)indirect);
-      }
-      rsect(xint(a3), (char*)indirect);
-      if((x = indirect[k1]) == 0)
-      {
-	x = indirect[k1] = xint(freeblock++);
-        usedblocks ++;
-        wsect(xint(a3), (char*)indirect);
-      }
-      x = xint(x);
-      //printf("%d--", fbn);
+  if(din.ext[0].len == 0){
+    if(off + n <= NINLINE){
+      // Small enough to keep in the inode.
+      bcopy(p, din.inl + off, n);
+      din.size = xint(off + n);
+      winode(inum, &din);
+      return;
     }
-    //printf("%d\n", x);
-    n1 = min(n, (fbn + 1) * 512 - off);
+    if(off > 0){
+      // Move what is in the inode out to the first block.
+      bzero(buf, sizeof(buf));
+      bcopy(din.inl, buf, off);
+      bzero(din.inl, sizeof(din.inl));
+      wsect(bmap(&din, 0), buf);
+    }
+  }
+  while(n > 0){
+    fbn = off / BSIZE;
+    assert(fbn < MAXFILE);
+    x = bmap(&din, fbn);
+    n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
-    //printf("hjw 2 %d %d %d %d\n", n, off - (fbn * 512), n1, sizeof(p));
-    bcopy(p, buf + off - (fbn * 512), n1);
-      //   printf("hjw 3 %d\n", n);
+    bcopy(p, buf + off - (fbn * BSIZE), n1);
     wsect(x, buf);
     n -= n1;
     off += n1;
@@ -335,3 +349,77 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Same hash as the kernel's (fs.c).
+uint
+dirhash(char *name)
+{
+  uint h;
+
+  for(h = 0; *name; name++)
+    h = h*31 + (uchar)*name;
+  return h % NDIRHASH;
+}
+
+// Add (name, inum) to directory block blk if it has room.
+int
+hdiradd(char *blk, char *name, uint inum)
+{
+  uint off, used, need, reclen;
+  struct hdirent *he, *ne;
+
+  need = HDIRENTSIZE(strlen(name));
+  for(off = sizeof(uint); off < BSIZE; off += reclen){
+    he = (struct hdirent*)(blk + off);
+    reclen = xshort(he->reclen);
+    used = he->inum ? HDIRENTSIZE(xshort(he->namelen)) : 0;
+    if(reclen - used < need)
+      continue;
+    ne = he;
+    if(used > 0){
+      ne = (struct hdirent*)(blk + off + used);
+      ne->reclen = xshort(reclen - used);
+      he->reclen = xshort(used);
+    }
+    ne->inum = xshort(inum);
+    ne->namelen = xshort(strlen(name));
+    memmove(ne->name, name, strlen(name));
+    return 1;
+  }
+  return 0;
+}
+
+// Add (name, inum) to hashed directory dinum, which
+// already has its header block.
+void
+dirlink(uint dinum, char *name, uint inum)
+{
+  struct dinode din;
+  char hdr[BSIZE], blk[BSIZE];
+  struct dirhead *dh;
+  struct hdirent *he;
+  uint h, bn;
+
+  assert(strlen(name) <= MAXNAME);
+  rinode(dinum, &din);
+  rsect(bmap(&din, 0), hdr);
+  dh = (struct dirhead*)hdr;
+  h = dirhash(name);
+  for(bn = xint(dh->bucket[h]); bn != 0; bn = xint(*(uint*)blk)){
+    rsect(bmap(&din, bn), blk);
+    if(hdiradd(blk, name, inum)){
+      wsect(bmap(&din, bn), blk);
+      return;
+    }
+  }
+
+  // Start a new block at the head of the chain.
+  bzero(blk, sizeof(blk));
+  *(uint*)blk = dh->bucket[h];
+  he = (struct hdirent*)(blk + sizeof(uint));
+  he->reclen = xshort(BSIZE - sizeof(uint));
+  hdiradd(blk, name, inum);
+  dh->bucket[h] = xint(xint(din.size) / BSIZE);
+  wsect(bmap(&din, 0), hdr);
+  iappend(dinum, blk, BSIZE);
+}
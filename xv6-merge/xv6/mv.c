@@ -18,6 +18,26 @@ int main(int argc, char *argv[])
 		exit();
 	}
 	
+	//判断第二个参数是不是以"/"结尾，如果是，则补全路径
+	char com[128] = {};
+	strcpy(com, argv[2]);
+	int len1 = strlen(argv[1]);
+	int len2 = strlen(argv[2]);
+	if (argv[2][len2-1] == '/')
+	{
+		//找到argv[1]中的文件名
+		int i = len1 - 1;
+		for (; i >= 0; i--)
+			if (argv[1][i] == '/')
+				break;
+		i++;
+		strcpy(&com[len2], &argv[1][i]);
+	}
+	
+	//重命名只改目录项，不复制文件内容；失败时再复制
+	if(rename(argv[1], com) == 0)
+		exit();
+	
 	//打开源文件
 	int fd_src = open(argv[1], O_RDONLY);
 	if (fd_src == -1)
@@ -38,22 +58,6 @@ int main(int argc, char *argv[])
 		exit();
 	}
 
-	//判断第二个参数是不是以"/"结尾，如果是，则补全路径
-	char com[128] = {};
-	strcpy(com, argv[2]);
-	int len1 = strlen(argv[1]);
-	int len2 = strlen(argv[2]);
-	if (argv[2][len2-1] == '/')
-	{
-		//找到argv[1]中的文件名
-		int i = len1 - 1;
-		for (; i >= 0; i--)
-			if (argv[1][i] == '/')
-				break;
-		i++;
-		strcpy(&com[len2], &argv[1][i]);
-	}
-	
 	//打开目标文件
 	int fd_dest = open(com, O_WRONLY|O_CREATE);
 	if (fd_dest == -1)
@@ -62,11 +66,14 @@ int main(int argc, char *argv[])
 		exit();
 	}
 	
-	//复制文件
+	//复制文件：在内核中复制，不支持时（如设备文件）用read/write
 	char buf[BUF_SIZE] = {};
 	int len = 0;
-	while((len = read(fd_src, buf, BUF_SIZE)) > 0)
-		write(fd_dest, buf, len);
+	while((len = copy_file_range(fd_src, fd_dest, 1<<20)) > 0)
+		;
+	if(len < 0)
+		while((len = read(fd_src, buf, BUF_SIZE)) > 0)
+			write(fd_dest, buf, len);
 	
 	//关闭文件
 	close(fd_src);
@@ -102,7 +109,7 @@ void ls(char *path)
 {
 	char buf[512], *p;
 	int fd;
-	struct dirent de;
+	uint inum;
 	struct stat st;
 	
 	if((fd = open(path, 0)) < 0)
@@ -125,7 +132,7 @@ void ls(char *path)
 		break;
 		
 		case T_DIR:
-		if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf)
+		if(strlen(path) + 1 + MAXNAME + 1 > sizeof buf)
 		{
 			printf(1, "path too long\n");
 			break;
@@ -134,12 +141,8 @@ void ls(char *path)
 		p = buf+strlen(buf);
 		*p++ = '/';
 		
-		while(read(fd, &de, sizeof(de)) == sizeof(de))
+		while(readdir(fd, &inum, p))
 		{
-			if(de.inum == 0)
-				continue;
-			memmove(p, de.name, DIRSIZ);
-			p[DIRSIZ] = 0;
 			if(stat(buf, &st) < 0)
 			{
 				printf(1, "cannot stat %s\n", buf);
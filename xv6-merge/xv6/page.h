@@ -0,0 +1,25 @@
+// A page of a file in the page cache (pcache.c): PGSIZE bytes
+// of the file starting at pgno*PGSIZE, made of PGBLOCKS blocks.
+// Only blocks that are in the file, and have been read or
+// written, are valid.  addr[] remembers where each block lives
+// on the disk, so a dirty page can be written back without
+// looking at the inode.
+#define PGBLOCKS (PGSIZE/BSIZE)
+#define NPREAD   (1 + NREADAHEAD/PGBLOCKS)  // most pages one pread reads
+
+struct page {
+  int flags;
+  uint dev;
+  uint inum;            // 0 if the page belongs to no file
+  uint pgno;
+  uint valid;           // blocks whose contents are in data, one bit each
+  uint dirty;           // blocks to be written back, one bit each
+  uint addr[PGBLOCKS];  // disk block of each block, 0 if not known
+  uint tick;            // when dirty became non-zero
+  char *data;           // PGSIZE bytes from kalloc, or 0
+  struct page *hnext;   // hash chain
+  struct page *prev;    // LRU list
+  struct page *next;
+};
+#define P_BUSY 0x1  // page is locked by some process
+
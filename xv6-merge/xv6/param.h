@@ -1,10 +1,24 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NBUF         10  // size of disk block cache
-#define NINODE       50  // maximum number of active i-nodes
+#define NOFILE       16  // open files per process before its table grows
+#define NOFILEMAX  1024  // most open files per process; at most 32*32
+#define NFILE      1000  // most open files per system, until ulimit changes it
+#define NIOV         64  // most segments in one readv or writev
+#define NBUF         64  // size of disk block cache
+#define NPCACHE     256  // most pages of file data to cache
+#define FLUSHTICKS  100  // how often the buffer flusher runs
+#define FLUSHAGE    300  // write back buffers dirty for this long
+#define NINODE       50  // i-nodes to cache before recycling unused ones
+#define NDCACHE     128  // entries in the name cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define STRIPEDEV     2  // disk ROOTDEV is striped with, if any
+#define NREADAHEAD   16  // blocks to read ahead of a sequential reader
+#define PREALLOC     64  // blocks reserved after the last one of a file being written
+#define NPREALLOC    16  // files with such a reservation at once
+#define MAXOPBLOCKS  10  // max # of metadata blocks any FS op writes
+#define MAXOPALLOC   40  // max # of blocks any FS op allocates
+#define LOGSIZE      30  // max blocks in a transaction; the log holds two
+#define PIPEMAX   65536  // most bytes a pipe holds; a multiple of PGSIZE
 #define PHYSTOP  0x1000000 // use phys mem up to here as free pool
@@ -0,0 +1,449 @@
+// Page cache.
+//
+// The contents of regular files are cached in whole pages of
+// memory, keyed by device, inode number and page number,
+// rather than in the buffer cache.  readi and writei copy in
+// and out of pages, so read, write and exec share them.  A page
+// is filled with one disk request per run of consecutive blocks,
+// usually one for the whole page, and a sequential reader gets
+// the next pages filled in the same batch (see readi in fs.c).
+//
+// Interface:
+// * pget returns a locked page, which may not be valid yet.
+// * The file system fills in addr[] for the blocks it wants
+//     and calls pread to read them, or changes data, sets the
+//     valid bits, and calls pdirty to have blocks written back.
+// * prelse releases the page.
+// * pcinval drops the pages of a file that is being truncated.
+//
+// Writes are delayed, as in the buffer cache: dirty pages are
+// written back by the buffer flusher when they are FLUSHAGE ticks
+// old, by pget when it needs a page and all idle ones are dirty,
+// and by pcsync, which each log commit calls first so that
+// committed inodes never point at data that is not on disk.
+//
+// Memory for pages comes from kalloc, up to NPCACHE pages.
+// When kalloc runs out it calls pcreclaim, which gives back
+// the memory of the least recently used clean page.
+//
+// splice puts the memory of a page in a pipe without copying it
+// (see igetpage in fs.c), so a page's memory may also belong to
+// a pipe.  Such memory is never reused for other data: pown
+// gives the page a copy before the file system changes it, and
+// a recycled page lets go of it.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "buf.h"
+#include "fs.h"
+#include "page.h"
+#include "stat.h"
+
+#define NPHASH 61
+#define NPIO   8   // disk requests pio hands to the driver at once
+
+struct {
+  struct spinlock lock;
+  struct page page[NPCACHE];
+  struct page *hash[NPHASH];
+
+  // Linked list of all pages, through prev/next.
+  // head.next is most recently used.
+  struct page head;
+
+  int waiting;  // someone is waiting for any page to be idle
+  uint ndirty;  // pages with dirty blocks
+  uint nmem;    // pages holding memory
+  uint hits;    // pget found the page
+  uint misses;  // pget made a new page
+} pcache;
+
+void
+pcinit(void)
+{
+  struct page *p;
+
+  initlock(&pcache.lock, "pcache");
+  pcache.head.prev = &pcache.head;
+  pcache.head.next = &pcache.head;
+  for(p = pcache.page; p < pcache.page+NPCACHE; p++){
+    p->next = pcache.head.next;
+    p->prev = &pcache.head;
+    pcache.head.next->prev = p;
+    pcache.head.next = p;
+  }
+}
+
+static uint
+phash(uint dev, uint inum, uint pgno)
+{
+  return (dev + inum*31 + pgno) % NPHASH;
+}
+
+// Take p off its hash chain; it belongs to no file any more.
+// Caller holds pcache.lock.
+static void
+unhash(struct page *p)
+{
+  struct page **pp;
+
+  if(p->inum == 0)
+    return;
+  for(pp = &pcache.hash[phash(p->dev, p->inum, p->pgno)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == p){
+      *pp = p->hnext;
+      break;
+    }
+  }
+  p->inum = 0;
+}
+
+// Mark p not busy and wake anyone waiting for it or for an
+// idle page.  Caller holds pcache.lock.
+static void
+punbusy(struct page *p)
+{
+  p->flags &= ~P_BUSY;
+  wakeup(p);
+  if(pcache.waiting){
+    pcache.waiting = 0;
+    wakeup(&pcache.waiting);
+  }
+}
+
+// Read or write the blocks of the locked pages pv[0..n-1] that
+// are set in mask[i], and wait.  Each run of blocks that are
+// consecutive on the disk is one request; all of them go to the
+// driver in batches of up to NPIO.
+static void
+pio(struct page **pv, uint *mask, int n, int write)
+{
+  struct buf b[NPIO], *bv[NPIO];
+  struct page *p;
+  int i, j, k, nb;
+
+  nb = 0;
+  for(i = 0; i < n; i++){
+    p = pv[i];
+    for(j = 0; j < PGBLOCKS; j = k){
+      k = j+1;
+      if(!(mask[i] & (1<<j)))
+        continue;
+      while(k < PGBLOCKS && (mask[i] & (1<<k)) &&
+            p->addr[k] == p->addr[j] + (k-j) &&
+            k-j < bcontig(p->dev, p->addr[j]))
+        k++;
+      if(nb == NPIO){
+        bdirect(bv, nb);
+        nb = 0;
+      }
+      b[nb].dev = p->dev;
+      b[nb].blockno = p->addr[j];
+      b[nb].nsect = (k-j) * SPB;
+      b[nb].data = (uchar*)p->data + j*BSIZE;
+      b[nb].flags = B_BUSY | (write ? B_DIRTY : 0);
+      bv[nb] = &b[nb];
+      nb++;
+    }
+  }
+  if(nb > 0)
+    bdirect(bv, nb);
+}
+
+// Write back the idle dirty page p.
+// Caller holds pcache.lock, which is released during the write.
+static void
+pflush1(struct page *p)
+{
+  uint mask;
+
+  p->flags |= P_BUSY;
+  mask = p->dirty;
+  release(&pcache.lock);
+  pio(&p, &mask, 1, 1);
+  acquire(&pcache.lock);
+  p->dirty = 0;
+  pcache.ndirty--;
+  punbusy(p);
+}
+
+// Take the memory of the least recently used idle clean page
+// that no pipe shares.  Caller holds pcache.lock.
+static char*
+psteal(void)
+{
+  struct page *p;
+  char *mem;
+
+  for(p = pcache.head.prev; p != &pcache.head; p = p->prev){
+    if(p->data && !(p->flags & P_BUSY) && p->dirty == 0 &&
+       kref(p->data) == 1){
+      unhash(p);
+      mem = p->data;
+      p->data = 0;
+      return mem;
+    }
+  }
+  return 0;
+}
+
+// Return the locked page pgno of inode inum on dev, with no
+// blocks valid if it was not cached.  Returns 0 if there is
+// no memory for it.
+struct page*
+pget(uint dev, uint inum, uint pgno)
+{
+  struct page *p, **hp;
+  char *mem;
+
+  hp = &pcache.hash[phash(dev, inum, pgno)];
+  acquire(&pcache.lock);
+
+ loop:
+  // Is the page cached?
+  for(p = *hp; p; p = p->hnext){
+    if(p->dev == dev && p->inum == inum && p->pgno == pgno){
+      if(p->flags & P_BUSY){
+        sleep(p, &pcache.lock);
+        goto loop;
+      }
+      p->flags |= P_BUSY;
+      pcache.hits++;
+      release(&pcache.lock);
+      return p;
+    }
+  }
+
+  // Recycle the least recently used idle clean page.
+  for(p = pcache.head.prev; p != &pcache.head; p = p->prev)
+    if(!(p->flags & P_BUSY) && p->dirty == 0)
+      goto found;
+
+  // All idle pages are dirty: write one back and start over,
+  // since the page may have been cached while we slept.
+  for(p = pcache.head.prev; p != &pcache.head; p = p->prev){
+    if(!(p->flags & P_BUSY)){
+      pflush1(p);
+      goto loop;
+    }
+  }
+
+  pcache.waiting = 1;
+  sleep(&pcache.waiting, &pcache.lock);
+  goto loop;
+
+found:
+  unhash(p);
+  p->dev = dev;
+  p->inum = inum;
+  p->pgno = pgno;
+  p->flags = P_BUSY;
+  p->valid = 0;
+  memset(p->addr, 0, sizeof(p->addr));
+  p->hnext = *hp;
+  *hp = p;
+  pcache.misses++;
+
+  if(p->data && kref(p->data) > 1){
+    kfree(p->data);
+    p->data = 0;
+    pcache.nmem--;
+  }
+  if(p->data == 0){
+    release(&pcache.lock);
+    mem = kalloc();
+    acquire(&pcache.lock);
+    if(mem)
+      pcache.nmem++;
+    else if((mem = psteal()) == 0){
+      unhash(p);
+      punbusy(p);
+      release(&pcache.lock);
+      return 0;
+    }
+    p->data = mem;
+  }
+  release(&pcache.lock);
+  return p;
+}
+
+// Read the blocks of the locked pages pv[0..n-1] that are not
+// valid but whose disk address is known, in one batch.
+void
+pread(struct page **pv, int n)
+{
+  uint mask[NPREAD];
+  int i, j;
+
+  if(n > NPREAD)
+    panic("pread");
+  for(i = 0; i < n; i++){
+    mask[i] = 0;
+    for(j = 0; j < PGBLOCKS; j++)
+      if(pv[i]->addr[j] && !(pv[i]->valid & (1<<j)))
+        mask[i] |= 1<<j;
+  }
+  pio(pv, mask, n, 0);
+  for(i = 0; i < n; i++)
+    pv[i]->valid |= mask[i];
+}
+
+// The caller has changed the blocks of locked page p that are
+// set in mask, whose disk addresses are in p->addr[], and made
+// them valid.  Write them back later.
+void
+pdirty(struct page *p, uint mask)
+{
+  if((p->flags & P_BUSY) == 0)
+    panic("pdirty");
+  acquire(&pcache.lock);
+  if(p->dirty == 0){
+    p->tick = ticks;
+    pcache.ndirty++;
+  }
+  p->dirty |= mask;
+  release(&pcache.lock);
+}
+
+// Make the memory of locked page p its own, copying it if a
+// pipe shares it, before the caller changes it.
+// Returns -1 if there is no memory for the copy.
+int
+pown(struct page *p)
+{
+  char *mem;
+
+  if(kref(p->data) == 1)
+    return 0;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, p->data, PGSIZE);
+  kfree(p->data);
+  p->data = mem;
+  return 0;
+}
+
+// Make mem, a page of memory the caller owns, the memory of
+// locked page p, and return p's old memory to the caller.
+char*
+pswap(struct page *p, char *mem)
+{
+  char *old;
+
+  old = p->data;
+  p->data = mem;
+  return old;
+}
+
+// Release the locked page p.
+void
+prelse(struct page *p)
+{
+  if((p->flags & P_BUSY) == 0)
+    panic("prelse");
+
+  acquire(&pcache.lock);
+  p->next->prev = p->prev;
+  p->prev->next = p->next;
+  p->next = pcache.head.next;
+  p->prev = &pcache.head;
+  pcache.head.next->prev = p;
+  pcache.head.next = p;
+  punbusy(p);
+  release(&pcache.lock);
+}
+
+// Drop the pages of inode inum on dev, without writing them
+// back: its blocks are about to be freed.  Called by itrunc.
+void
+pcinval(uint dev, uint inum)
+{
+  struct page *p;
+
+  acquire(&pcache.lock);
+ loop:
+  for(p = pcache.page; p < pcache.page+NPCACHE; p++){
+    if(p->inum != inum || p->dev != dev)
+      continue;
+    if(p->flags & P_BUSY){
+      sleep(p, &pcache.lock);
+      goto loop;
+    }
+    if(p->dirty){
+      p->dirty = 0;
+      pcache.ndirty--;
+    }
+    unhash(p);
+  }
+  release(&pcache.lock);
+}
+
+// Write back every idle page that has been dirty
+// for at least age ticks.
+void
+pcflush(uint age)
+{
+  struct page *p;
+
+  acquire(&pcache.lock);
+ loop:
+  for(p = pcache.head.prev; p != &pcache.head; p = p->prev){
+    if(p->dirty && !(p->flags & P_BUSY) && ticks - p->tick >= age){
+      pflush1(p);
+      goto loop;
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Write back all dirty pages and wait for them.  A dirty page
+// that someone is using is waited for and written after.
+void
+pcsync(void)
+{
+  struct page *p;
+
+  acquire(&pcache.lock);
+ loop:
+  for(p = pcache.head.prev; p != &pcache.head; p = p->prev){
+    if(p->dirty == 0)
+      continue;
+    if(p->flags & P_BUSY)
+      sleep(p, &pcache.lock);
+    else
+      pflush1(p);
+    goto loop;
+  }
+  release(&pcache.lock);
+}
+
+// Give the memory of one clean page back to kalloc.
+// Returns 0 if there is none to give.
+int
+pcreclaim(void)
+{
+  char *mem;
+
+  acquire(&pcache.lock);
+  if((mem = psteal()) != 0)
+    pcache.nmem--;
+  release(&pcache.lock);
+  if(mem == 0)
+    return 0;
+  kfree(mem);
+  return 1;
+}
+
+// Copy the page cache counters to st.
+void
+pcstat(struct iostat *st)
+{
+  acquire(&pcache.lock);
+  st->pghit = pcache.hits;
+  st->pgmiss = pcache.misses;
+  st->npage = pcache.nmem;
+  release(&pcache.lock);
+}
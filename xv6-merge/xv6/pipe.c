@@ -5,17 +5,52 @@
 #include "proc.h"
 #include "fs.h"
 #include "file.h"
+#include "fcntl.h"
 #include "spinlock.h"
 
-#define PIPESIZE 512
+// A pipe's data is a queue of buffers, each a piece of a page.
+// A writer adds to the last buffer while its page has room and
+// is the pipe's alone, and otherwise starts a new one, up to
+// NPIPEBUF of them, so a pipe that carries little costs little
+// and one that carries a stream lets the writer run well ahead
+// of the reader.  Reads and writes move each buffer's piece
+// with one memmove.  splice and vmsplice put pages of the page
+// cache or of a process in the queue without copying them (see
+// pipereserve); the pipe then shares the page (see kdup in
+// kalloc.c) and never writes into it.  splice takes pages out
+// the same way, holding the read side until it has written
+// them, so what it cannot write goes back (see pipegetpage).
+// A reader or writer wakes the other side only if it is
+// asleep, and once per call; a reader wakes a waiting writer
+// only when at most half the buffers are in use, so a writer
+// is not woken to move a few bytes at a time.  Every change
+// that may make an end ready also wakes processes in poll (see
+// pollwakeup in file.c).
+
+#define NPIPEBUF (PIPEMAX / PGSIZE)
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+struct pipebuf {
+  char *page;
+  uint off;       // offset in page of the first byte
+  uint len;       // bytes in the buffer
+};
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  struct pipebuf buf[NPIPEBUF];  // ring of buffers
+  int head;       // oldest buffer
+  int nbuf;       // buffers in use
+  char *spare;    // an emptied page, kept for the next buffer
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int nrsleep;    // readers asleep
+  int nwsleep;    // writers asleep
+  int held;       // a splice has the oldest bytes (see pipegetpage)
+  int nresv;      // buffers kept for pipeputpage (see pipereserve)
 };
 
 int
@@ -33,14 +68,23 @@ pipealloc(struct file **f0, struct file **f1)
   p->writeopen = 1;
   p->nwrite = 0;
   p->nread = 0;
+  p->head = 0;
+  p->nbuf = 0;
+  p->spare = 0;
+  p->nrsleep = 0;
+  p->nwsleep = 0;
+  p->held = 0;
+  p->nresv = 0;
   initlock(&p->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
+  (*f0)->nonblock = 0;
   (*f0)->pipe = p;
   (*f1)->type = FD_PIPE;
   (*f1)->readable = 0;
   (*f1)->writable = 1;
+  (*f1)->nonblock = 0;
   (*f1)->pipe = p;
   return 0;
 
@@ -57,6 +101,8 @@ pipealloc(struct file **f0, struct file **f1)
 void
 pipeclose(struct pipe *p, int writable)
 {
+  int i;
+
   acquire(&p->lock);
   if(writable){
     p->writeopen = 0;
@@ -65,54 +111,325 @@ pipeclose(struct pipe *p, int writable)
     p->readopen = 0;
     wakeup(&p->nwrite);
   }
+  pollwakeup();
   if(p->readopen == 0 && p->writeopen == 0) {
     release(&p->lock);
+    for(i = 0; i < p->nbuf; i++)
+      kfree(p->buf[(p->head + i) % NPIPEBUF].page);
+    if(p->spare)
+      kfree(p->spare);
     kfree((char*)p);
   } else
     release(&p->lock);
 }
 
+// Is there room in the last buffer of p for a writer to copy
+// into, which needs the page to be the pipe's alone?
+// Caller holds p->lock.
+static struct pipebuf*
+piperoom(struct pipe *p)
+{
+  struct pipebuf *b;
+
+  if(p->nbuf == 0)
+    return 0;
+  b = &p->buf[(p->head + p->nbuf - 1) % NPIPEBUF];
+  if(b->off + b->len < PGSIZE && kref(b->page) == 1)
+    return b;
+  return 0;
+}
+
+// Return the buffer a writer can copy into, starting a new one
+// if the last has no room, or 0 if p is full or memory is short.
+// Caller holds p->lock.
+static struct pipebuf*
+pipetail(struct pipe *p)
+{
+  struct pipebuf *b;
+  char *mem;
+
+  if((b = piperoom(p)) != 0)
+    return b;
+  if(p->nbuf + p->held + p->nresv >= NPIPEBUF)
+    return 0;
+  if((mem = p->spare) != 0)
+    p->spare = 0;
+  else if((mem = kalloc()) == 0)
+    return 0;
+  b = &p->buf[(p->head + p->nbuf) % NPIPEBUF];
+  b->page = mem;
+  b->off = 0;
+  b->len = 0;
+  p->nbuf++;
+  return b;
+}
+
+// Drop the oldest buffer of p, which has been read, keeping
+// its page for the next buffer if it was the pipe's alone.
+// Caller holds p->lock.
+static void
+pipepop(struct pipe *p)
+{
+  struct pipebuf *b;
+
+  b = &p->buf[p->head];
+  if(p->spare == 0 && kref(b->page) == 1)
+    p->spare = b->page;
+  else
+    kfree(b->page);
+  p->head = (p->head + 1) % NPIPEBUF;
+  p->nbuf--;
+}
+
+// Sleep until a writer may add to p.  Returns -1 if
+// the read side is closed or the caller is killed.
+// Caller holds p->lock.
+static int
+pipewait(struct pipe *p)
+{
+  if(p->readopen == 0 || proc->killed)
+    return -1;
+  if(p->nrsleep)
+    wakeup(&p->nread);
+  p->nwsleep++;
+  sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+  p->nwsleep--;
+  return 0;
+}
+
+// Write n bytes at addr to p.  If nonblock, write what fits
+// without waiting, and return -1 if nothing does.  Stops in
+// the same way if p is empty and there is no memory for it.
 int
-pipewrite(struct pipe *p, char *addr, int n)
+pipewrite(struct pipe *p, char *addr, int n, int nonblock)
 {
-  int i;
+  struct pipebuf *b;
+  int i, m;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE) {  //DOC: pipewrite-full
-      if(p->readopen == 0 || proc->killed){
+  for(i = 0; i < n; i += m){
+    while((b = pipetail(p)) == 0){  //DOC: pipewrite-full
+      // With no buffers, memory is short and no reader can
+      // make room: return rather than wait.
+      if((nonblock || p->nbuf == 0) && i > 0)
+        goto out;
+      if(nonblock || p->nbuf == 0 || pipewait(p) < 0){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
-      sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    m = min(n - i, PGSIZE - (b->off + b->len));
+    memmove(b->page + b->off + b->len, addr + i, m);
+    b->len += m;
+    p->nwrite += m;
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+ out:
+  if(p->nrsleep)
+    wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+  pollwakeup();
   release(&p->lock);
-  return n;
+  return i;
 }
 
+// Keep a buffer of p for the caller's next pipeputpage, so
+// that it cannot fail for want of room once the caller has
+// taken the data from elsewhere.  Returns -1 if the read side
+// is closed, the caller is killed, or nonblock and p is full.
 int
-piperead(struct pipe *p, char *addr, int n)
+pipereserve(struct pipe *p, int nonblock)
 {
-  int i;
-
   acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
-    if(proc->killed){
+  while(p->readopen && p->nbuf + p->held + p->nresv >= NPIPEBUF){
+    if(nonblock || pipewait(p) < 0){
       release(&p->lock);
       return -1;
     }
+  }
+  if(p->readopen == 0){
+    release(&p->lock);
+    return -1;
+  }
+  p->nresv++;
+  release(&p->lock);
+  return 0;
+}
+
+// Add the n bytes at off in page to p, in the buffer kept by
+// pipereserve, without copying them.  The pipe takes over the
+// caller's reference to page, and does not write into it.
+// Returns -1, leaving page to the caller, if the read side is
+// closed.  With n 0, just gives the buffer back.
+int
+pipeputpage(struct pipe *p, char *page, uint off, uint n)
+{
+  struct pipebuf *b;
+
+  acquire(&p->lock);
+  p->nresv--;
+  if(n == 0 || p->readopen == 0){
+    if(p->nwsleep)
+      wakeup(&p->nwrite);
+    pollwakeup();
+    release(&p->lock);
+    return n == 0 ? 0 : -1;
+  }
+  b = &p->buf[(p->head + p->nbuf) % NPIPEBUF];
+  b->page = page;
+  b->off = off;
+  b->len = n;
+  p->nbuf++;
+  p->nwrite += n;
+  if(p->nrsleep)
+    wakeup(&p->nread);
+  pollwakeup();
+  release(&p->lock);
+  return 0;
+}
+
+// Sleep until p has data or no writer, and no splice holds
+// its read side.  Returns -1 if the caller is killed, or at
+// once if nonblock.  Caller holds p->lock.
+static int
+pipewaitdata(struct pipe *p, int nonblock)
+{
+  while(p->held || (p->nbuf == 0 && p->writeopen)){  //DOC: pipe-empty
+    if(nonblock || proc->killed)
+      return -1;
+    p->nrsleep++;
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
+    p->nrsleep--;
+  }
+  return 0;
+}
+
+// Read up to n bytes from p into addr.  If nonblock,
+// return -1 instead of waiting for data.
+int
+piperead(struct pipe *p, char *addr, int n, int nonblock)
+{
+  struct pipebuf *b;
+  int i, m;
+
+  acquire(&p->lock);
+  if(pipewaitdata(p, nonblock) < 0){
+    release(&p->lock);
+    return -1;
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  for(i = 0; i < n && p->nbuf > 0; i += m){  //DOC: piperead-copy
+    b = &p->buf[p->head];
+    m = min(n - i, b->len);
+    memmove(addr + i, b->page + b->off, m);
+    b->off += m;
+    b->len -= m;
+    p->nread += m;
+    if(b->len == 0)
+      pipepop(p);
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  if(p->nwsleep && p->nbuf <= NPIPEBUF/2)
+    wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  pollwakeup();
   release(&p->lock);
   return i;
 }
+
+// Take up to max bytes from the front of p without copying
+// them: set *page, to which the caller gets a reference, and
+// *off to where they are.  Returns how many, 0 if p is empty
+// and has no writer, or -1 if the caller is killed or, if
+// nonblock, it would have to wait.  Until the caller gives back what it
+// did not use with pipeputback, other readers wait and one
+// buffer is kept free for it.
+int
+pipegetpage(struct pipe *p, char **page, uint *off, uint max, int nonblock)
+{
+  struct pipebuf *b;
+  uint n;
+
+  acquire(&p->lock);
+  if(pipewaitdata(p, nonblock) < 0){
+    release(&p->lock);
+    return -1;
+  }
+  if(p->nbuf == 0){
+    release(&p->lock);
+    return 0;
+  }
+  b = &p->buf[p->head];
+  *page = b->page;
+  *off = b->off;
+  n = min(max, b->len);
+  if(n == b->len){
+    p->head = (p->head + 1) % NPIPEBUF;
+    p->nbuf--;
+  } else {
+    kdup(b->page);
+    b->off += n;
+    b->len -= n;
+  }
+  p->nread += n;
+  p->held = 1;
+  release(&p->lock);
+  return n;
+}
+
+// Put the n bytes at off in page, the end of what the caller
+// took with pipegetpage and did not use, back at the front of
+// p, and let other readers go on.  p takes over the caller's
+// reference to page if n > 0.
+void
+pipeputback(struct pipe *p, char *page, uint off, uint n)
+{
+  struct pipebuf *b;
+
+  acquire(&p->lock);
+  if(n > 0){
+    b = &p->buf[p->head];
+    if(p->nbuf > 0 && b->page == page && b->off == off + n){
+      // The rest of a buffer pipegetpage left in p.
+      b->off = off;
+      b->len += n;
+      kfree(page);
+    } else {
+      if(p->nbuf == NPIPEBUF)
+        panic("pipeputback");
+      p->head = (p->head + NPIPEBUF - 1) % NPIPEBUF;
+      b = &p->buf[p->head];
+      b->page = page;
+      b->off = off;
+      b->len = n;
+      p->nbuf++;
+    }
+    p->nread -= n;
+  }
+  p->held = 0;
+  if(p->nrsleep)
+    wakeup(&p->nread);
+  if(p->nwsleep && p->nbuf <= NPIPEBUF/2)
+    wakeup(&p->nwrite);
+  pollwakeup();
+  release(&p->lock);
+}
+
+// Which events for poll hold for the read end of p,
+// or the write end if writable?
+int
+pipepoll(struct pipe *p, int writable)
+{
+  int r;
+
+  r = 0;
+  acquire(&p->lock);
+  if(writable){
+    if(p->readopen == 0)
+      r |= POLLERR;
+    else if(p->nbuf + p->held + p->nresv < NPIPEBUF || piperoom(p))
+      r |= POLLOUT;
+  } else {
+    if(p->nbuf > 0 && !p->held)
+      r |= POLLIN;
+    if(p->writeopen == 0)
+      r |= POLLHUP;
+  }
+  release(&p->lock);
+  return r;
+}
@@ -0,0 +1,64 @@
+// Pipe bandwidth benchmark.
+// A child writes NBYTES into a pipe in writes of each size
+// below while the parent reads them in reads of the same size,
+// and the parent reports how long each size took in clock
+// ticks and the bandwidth that makes.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NBYTES (8*1024*1024)
+
+char buf[65536];
+int sizes[] = { 64, 512, 4096, 65536 };
+
+void
+run(int n)
+{
+  int fds[2], pid, i, m, total, t0, t;
+
+  if(pipe(fds) < 0){
+    printf(1, "pipebench: pipe failed\n");
+    exit();
+  }
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    printf(1, "pipebench: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(i = 0; i < NBYTES; i += n){
+      if(write(fds[1], buf, n) != n){
+        printf(1, "pipebench: write failed\n");
+        exit();
+      }
+    }
+    exit();
+  }
+  close(fds[1]);
+  total = 0;
+  while((m = read(fds[0], buf, n)) > 0)
+    total += m;
+  close(fds[0]);
+  wait();
+  t = uptime() - t0;
+  if(total != NBYTES){
+    printf(1, "pipebench: read %d bytes, not %d\n", total, NBYTES);
+    exit();
+  }
+  printf(1, "%d-byte transfers: %d KB in %d ticks, %d KB/tick\n",
+         n, NBYTES/1024, t, NBYTES/1024/(t > 0 ? t : 1));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++)
+    run(sizes[i]);
+  exit();
+}
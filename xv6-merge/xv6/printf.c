@@ -2,14 +2,38 @@
 #include "stat.h"
 #include "user.h"
 
+// The output of one printf or fprintf, gathered so that it
+// costs one write instead of one per character.  Goes to
+// stream fp if it is set, else to fd.
+struct pbuf {
+  int fd;
+  FILE *fp;
+  int n;
+  char buf[128];
+};
+
+static void
+pflush(struct pbuf *b)
+{
+  if(b->n == 0)
+    return;
+  if(b->fp)
+    fwrite(b->buf, 1, b->n, b->fp);
+  else
+    write(b->fd, b->buf, b->n);
+  b->n = 0;
+}
+
 static void
-putc(int fd, char c)
+putc(struct pbuf *b, char c)
 {
-  write(fd, &c, 1);
+  if(b->n == sizeof(b->buf))
+    pflush(b);
+  b->buf[b->n++] = c;
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(struct pbuf *b, int xx, int base, int sgn)
 {
   static char digits[] = "0123456789ABCDEF";
   char buf[16];
@@ -32,33 +56,32 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    putc(b, buf[i]);
 }
 
-// Print to the given fd. Only understands %d, %x, %p, %s.
-void
-printf(int fd, char *fmt, ...)
+// Format fmt with the arguments at ap into b.
+// Only understands %d, %x, %p, %s, %c.
+static void
+format(struct pbuf *b, char *fmt, uint *ap)
 {
   char *s;
   int c, i, state;
-  uint *ap;
 
   state = 0;
-  ap = (uint*)(void*)&fmt + 1;
   for(i = 0; fmt[i]; i++){
     c = fmt[i] & 0xff;
     if(state == 0){
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        putc(b, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, *ap, 10, 1);
+        printint(b, *ap, 10, 1);
         ap++;
       } else if(c == 'x' || c == 'p'){
-        printint(fd, *ap, 16, 0);
+        printint(b, *ap, 16, 0);
         ap++;
       } else if(c == 's'){
         s = (char*)*ap;
@@ -66,20 +89,45 @@ printf(int fd, char *fmt, ...)
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          putc(b, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, *ap);
+        putc(b, *ap);
         ap++;
       } else if(c == '%'){
-        putc(fd, c);
+        putc(b, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(b, '%');
+        putc(b, c);
       }
       state = 0;
     }
   }
+  pflush(b);
+}
+
+// Print to the given fd, at once, bypassing any stream on it.
+void
+printf(int fd, char *fmt, ...)
+{
+  struct pbuf b;
+
+  b.fd = fd;
+  b.fp = 0;
+  b.n = 0;
+  format(&b, fmt, (uint*)(void*)&fmt + 1);
+}
+
+// Print to stream fp (see stdio.c).
+void
+fprintf(FILE *fp, char *fmt, ...)
+{
+  struct pbuf b;
+
+  b.fd = -1;
+  b.fp = fp;
+  b.n = 0;
+  format(&b, fmt, (uint*)(void*)&fmt + 1);
 }
@@ -103,6 +103,7 @@ found:
   p->context = (struct context*)sp;
   memset(p->context, 0, sizeof *p->context);
   p->context->eip = (uint)forkret;
+  fdinit(p);
   return p;
 }
 
@@ -134,6 +135,23 @@ userinit(void)
   p->state = RUNNABLE;
 }
 
+// Set up a kernel process that runs fn, which must not return.
+// It has no user memory: its page table maps only the kernel.
+void
+kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0 || !(p->pgdir = setupkvm()))
+    panic("kproc");
+  // allocproc arranged for forkret to return to trapret;
+  // have it return to fn instead.
+  *(uint*)(p->context + 1) = (uint)fn;
+  p->cwd = namei("/");
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -144,7 +162,10 @@ growproc(int n)
     if(!(sz = allocuvm(proc->pgdir, sz, sz + n)))
       return -1;
   } else if(n < 0){
-    if(!(sz = deallocuvm(proc->pgdir, sz, sz + n)))
+    ioringpause();
+    sz = deallocuvm(proc->pgdir, sz, sz + n);
+    ioringresume();
+    if(!sz)
       return -1;
   }
   proc->sz = sz;
@@ -158,7 +179,7 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
 
   // Allocate process.
@@ -179,9 +200,14 @@ fork(void)
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
 
-  for(i = 0; i < NOFILE; i++)
-    if(proc->ofile[i])
-      np->ofile[i] = filedup(proc->ofile[i]);
+  // Share the open files.
+  if(fdfork(np) < 0){
+    freevm(np->pgdir);
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
   np->cwd = idup(proc->cwd);
  
   pid = np->pid;
@@ -197,20 +223,18 @@ void
 exit(void)
 {
   struct proc *p;
-  int fd;
 
   if(proc == initproc)
     panic("init exiting");
 
+  ioringfree();
+
   // Close all open files.
-  for(fd = 0; fd < NOFILE; fd++){
-    if(proc->ofile[fd]){
-      fileclose(proc->ofile[fd]);
-      proc->ofile[fd] = 0;
-    }
-  }
+  fdcloseall();
 
+  begin_op();
   iput(proc->cwd);
+  end_op();
   proc->cwd = 0;
 
   acquire(&ptable.lock);
@@ -353,6 +377,11 @@ forkret(void)
 {
   // Still holding ptable.lock from scheduler.
   release(&ptable.lock);
+
+  // The first process sets up the root file system, which
+  // reads from disk and so cannot be done from main.
+  if(proc == initproc)
+    fsinit(ROOTDEV);
   
   // Return to "caller", actually trapret (see allocproc).
 }
@@ -57,6 +57,20 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A process's open files.  ofile starts out as small and is
+// replaced by a page of NOFILEMAX slots when an fd past NOFILE
+// is needed.  used has a bit for each open fd, and full a bit
+// for each word of used with no bit clear, so that fdalloc
+// finds the lowest free fd with two bit scans.
+struct fdtable {
+  struct file **ofile;         // ofile[fd] is open as fd, or 0
+  int size;                    // slots in ofile
+  int max;                     // most files the process may open
+  uint full;
+  uint used[NOFILEMAX/32];
+  struct file *small[NOFILE];
+};
+
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
@@ -69,8 +83,9 @@ struct proc {
   struct context *context;     // Switch here to run process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
-  struct file *ofile[NOFILE];  // Open files
+  struct fdtable fdt;          // Open files
   struct inode *cwd;           // Current directory
+  struct ioctx *io;            // Registered ioring, or 0
   char name[16];               // Process name (debugging)
 };
 
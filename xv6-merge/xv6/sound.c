@@ -65,31 +65,44 @@ void write_pci_config(uchar bus, uchar slot, uchar func, uchar offset, uint val)
     outsl(0xcfc, &val, 1);
 }
 
-void soundinit(void)
+// Scan the PCI buses for a function with the given vendor and
+// device ID.  Return 0 and its address in *bus, *slot, *func if
+// found, -1 if not.
+int
+pcifind(ushort vendor, ushort device, uchar *bus, uchar *slot, uchar *func)
 {
-  uchar bus, slot, func;
-  ushort vendor, device;
+  uchar b, s, f;
   uint res;
-// search bus, slot and func to find Intel 82801 AA AC'97 sound card
-  for (bus = 0; bus < 5; ++bus)
-    for (slot = 0; slot < 32; ++slot)
-      for (func = 0; func < 8; ++func)
+
+  for (b = 0; b < 5; ++b)
+    for (s = 0; s < 32; ++s)
+      for (f = 0; f < 8; ++f)
       {
-        res = read_pci_config(bus, slot, func, 0);
-        if (res != 0xffffffff)
+        res = read_pci_config(b, s, f, 0);
+        if (res != 0xffffffff && (res & 0xffff) == vendor &&
+            ((res >> 16) & 0xffff) == device)
         {
-            vendor = res & 0xffff;
-            device = (res >> 16) & 0xffff;
-            // find 0x24158086(Intel 82801
-            if (vendor == 0x8086 && device == 0x2415)
-            {
-                cprintf("Find sound card!\n");
-                // Init sound
-                soundcardinit(bus, slot, func);
-                return;
-            }
+          *bus = b;
+          *slot = s;
+          *func = f;
+          return 0;
         }
       }
+  return -1;
+}
+
+void soundinit(void)
+{
+  uchar bus, slot, func;
+
+  // search bus, slot and func to find Intel 82801 AA AC'97 sound card
+  if (pcifind(0x8086, 0x2415, &bus, &slot, &func) == 0)
+  {
+    cprintf("Find sound card!\n");
+    // Init sound
+    soundcardinit(bus, slot, func);
+    return;
+  }
   cprintf("Sound card not found!\n");
 }
 
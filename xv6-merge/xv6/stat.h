@@ -9,3 +9,12 @@ struct stat {
   short nlink; // Number of links to file
   uint size;   // Size of file in bytes
 };
+
+// Disk traffic and page cache use since boot, as returned by iostat.
+struct iostat {
+  uint nread;   // sectors read from disk
+  uint nwrite;  // sectors written to disk
+  uint pghit;   // file page lookups that found the page cached
+  uint pgmiss;  // file page lookups that did not
+  uint npage;   // pages of memory the page cache holds now
+};
@@ -0,0 +1,323 @@
+// Buffered I/O on file descriptors.
+//
+// A stream gathers what is written to it in a buffer and
+// writes it out with one system call when the buffer fills, at
+// the end of each line if the stream is line buffered, on
+// fflush or fclose, and at exit.  It reads a buffer at a time.
+// stdout is line buffered if it is the console and fully
+// buffered otherwise; stderr is not buffered.
+//
+// printf(fd, ...) does not use the streams: it writes each
+// call's output at once.  A program that writes to one file
+// both ways, or that forks with output still buffered, should
+// fflush first.
+
+#include "types.h"
+#include "stat.h"
+#include "fcntl.h"
+#include "user.h"
+
+#define NSTREAM 16
+#define BUFSIZ 1024
+
+struct iobuf {
+  int fd;
+  int used;       // the slot is open
+  int mode;       // _IOFBF, _IOLBF, _IONBF, or -1 until first use
+  int reading;    // buf holds input rather than output
+  char *buf;
+  int size;       // of buf
+  int n;          // bytes in buf
+  int r;          // next byte of buf to read
+  char mybuf;     // malloc'd buf, to free on fclose
+  char ch;        // buf of an unbuffered stream
+};
+
+static struct iobuf iob[NSTREAM] = {
+  { 0, 1, -1 },
+  { 1, 1, -1 },
+  { 2, 1, _IONBF },
+};
+
+FILE *stdin = &iob[0];
+FILE *stdout = &iob[1];
+FILE *stderr = &iob[2];
+
+// Write all n bytes at p to fd.
+static int
+writeall(int fd, char *p, int n)
+{
+  int i, m;
+
+  for(i = 0; i < n; i += m)
+    if((m = write(fd, p + i, n - i)) <= 0)
+      return -1;
+  return n;
+}
+
+// Get fp ready to read, or to write if w: give it a buffer
+// on first use, and write out or drop what it holds for the
+// other direction.
+static int
+start(FILE *fp, int w)
+{
+  struct stat st;
+
+  if(fp->buf == 0){
+    if(fp->mode < 0)
+      fp->mode = fstat(fp->fd, &st) == 0 && st.type == T_DEV ? _IOLBF : _IOFBF;
+    if(fp->mode != _IONBF && (fp->buf = malloc(BUFSIZ)) != 0){
+      fp->size = BUFSIZ;
+      fp->mybuf = 1;
+    } else {
+      fp->mode = _IONBF;
+      fp->buf = &fp->ch;
+      fp->size = 1;
+    }
+  }
+  if(w && fp->reading){
+    // Put the file offset back where the reader is.
+    if(fp->r < fp->n)
+      lseek(fp->fd, fp->r - fp->n, SEEK_CUR);
+    fp->n = fp->r = 0;
+    fp->reading = 0;
+  } else if(!w && !fp->reading){
+    if(fflush(fp) < 0)
+      return -1;
+    fp->reading = 1;
+  }
+  return 0;
+}
+
+// Use buf, size bytes, or one of its own if buf is 0, as the
+// buffer of fp, in the given mode.  Call before using fp.
+int
+setvbuf(FILE *fp, char *buf, int mode, uint size)
+{
+  if(fp->buf || mode < _IOFBF || mode > _IONBF)
+    return -1;
+  fp->mode = mode;
+  if(buf && size > 0 && mode != _IONBF){
+    fp->buf = buf;
+    fp->size = size;
+  }
+  return 0;
+}
+
+// Open fd as a stream.  mode is as for fopen.
+FILE*
+fdopen(int fd, char *mode)
+{
+  FILE *fp;
+
+  for(fp = iob; fp < iob + NSTREAM; fp++){
+    if(!fp->used){
+      memset(fp, 0, sizeof(*fp));
+      fp->fd = fd;
+      fp->used = 1;
+      fp->mode = -1;
+      return fp;
+    }
+  }
+  return 0;
+}
+
+// Open file path as a stream: "r" to read, "w" to write a
+// new file, "a" to write at the end, and "r+" or "w+" to do
+// both.  There is no O_TRUNC, so "w" removes the old file.
+FILE*
+fopen(char *path, char *mode)
+{
+  FILE *fp;
+  int fd, omode;
+
+  if(mode[0] == 'r')
+    omode = O_RDONLY;
+  else if(mode[0] == 'w' || mode[0] == 'a')
+    omode = O_CREATE | O_WRONLY;
+  else
+    return 0;
+  if(strchr(mode, '+'))
+    omode = (omode & ~O_WRONLY) | O_RDWR;
+  if(mode[0] == 'w')
+    unlink(path);
+  if((fd = open(path, omode)) < 0)
+    return 0;
+  if(mode[0] == 'a')
+    lseek(fd, 0, SEEK_END);
+  if((fp = fdopen(fd, mode)) == 0)
+    close(fd);
+  return fp;
+}
+
+// Write out what fp holds to write, or all streams if fp is 0.
+int
+fflush(FILE *fp)
+{
+  int r;
+
+  if(fp == 0){
+    r = 0;
+    for(fp = iob; fp < iob + NSTREAM; fp++)
+      if(fp->used && fflush(fp) < 0)
+        r = -1;
+    return r;
+  }
+  if(fp->reading || fp->n == 0)
+    return 0;
+  r = writeall(fp->fd, fp->buf, fp->n);
+  fp->n = 0;
+  return r < 0 ? -1 : 0;
+}
+
+int
+fclose(FILE *fp)
+{
+  int r;
+
+  r = fflush(fp);
+  if(close(fp->fd) < 0)
+    r = -1;
+  if(fp->mybuf)
+    free(fp->buf);
+  fp->used = 0;
+  return r;
+}
+
+// Write nmemb items of size bytes at p to fp.
+// Returns the number of items written.
+uint
+fwrite(void *p, uint size, uint nmemb, FILE *fp)
+{
+  char *s;
+  uint n, i, m;
+
+  s = p;
+  n = size * nmemb;
+  if(n == 0 || start(fp, 1) < 0)
+    return 0;
+  if(fp->mode == _IONBF || (fp->n == 0 && n >= fp->size)){
+    // Nothing to gather: write it at once.
+    if(fflush(fp) < 0 || writeall(fp->fd, s, n) < 0)
+      return 0;
+    return nmemb;
+  }
+  for(i = 0; i < n; i += m){
+    m = fp->size - fp->n;
+    if(m > n - i)
+      m = n - i;
+    memmove(fp->buf + fp->n, s + i, m);
+    fp->n += m;
+    if(fp->n == fp->size && fflush(fp) < 0)
+      return i / size;
+  }
+  if(fp->mode == _IOLBF)
+    for(i = 0; i < n; i++)
+      if(s[i] == '\n')
+        return fflush(fp) < 0 ? 0 : nmemb;
+  return nmemb;
+}
+
+int
+fputc(int c, FILE *fp)
+{
+  char ch;
+
+  ch = c;
+  return fwrite(&ch, 1, 1, fp) == 1 ? (uchar)ch : -1;
+}
+
+int
+fputs(char *s, FILE *fp)
+{
+  uint n;
+
+  n = strlen(s);
+  return fwrite(s, 1, n, fp) == n ? 0 : -1;
+}
+
+// Read the next buffer of input of fp.
+static int
+fill(FILE *fp)
+{
+  int n;
+
+  if((n = read(fp->fd, fp->buf, fp->size)) <= 0)
+    return -1;
+  fp->n = n;
+  fp->r = 0;
+  return 0;
+}
+
+// Return the next byte of fp, or -1 at end of file.
+int
+fgetc(FILE *fp)
+{
+  if(start(fp, 0) < 0)
+    return -1;
+  if(fp->r == fp->n && fill(fp) < 0)
+    return -1;
+  return (uchar)fp->buf[fp->r++];
+}
+
+// Read nmemb items of size bytes from fp into p.
+// Returns the number of whole items read.
+uint
+fread(void *p, uint size, uint nmemb, FILE *fp)
+{
+  char *s;
+  uint n, i, m;
+  int r;
+
+  s = p;
+  n = size * nmemb;
+  if(n == 0 || start(fp, 0) < 0)
+    return 0;
+  for(i = 0; i < n; i += m){
+    if(fp->r == fp->n){
+      if(n - i >= fp->size){
+        // Read big pieces straight into p.
+        if((r = read(fp->fd, s + i, n - i)) <= 0)
+          break;
+        m = r;
+        continue;
+      }
+      if(fill(fp) < 0)
+        break;
+    }
+    m = fp->n - fp->r;
+    if(m > n - i)
+      m = n - i;
+    memmove(s + i, fp->buf + fp->r, m);
+    fp->r += m;
+  }
+  return i / size;
+}
+
+// Read a line of at most size-1 bytes from fp into s,
+// keeping the newline.  Returns s, or 0 at end of file.
+char*
+fgets(char *s, int size, FILE *fp)
+{
+  int i, c;
+
+  for(i = 0; i+1 < size; ){
+    if((c = fgetc(fp)) < 0)
+      break;
+    s[i++] = c;
+    if(c == '\n')
+      break;
+  }
+  if(i == 0 && size > 1)
+    return 0;
+  s[i] = '\0';
+  return s;
+}
+
+// Write out buffered output, then exit.
+int
+exit(void)
+{
+  fflush(0);
+  _exit();
+}
@@ -0,0 +1,42 @@
+#!/usr/bin/perl -w
+
+# Split a file system image into two for RAID-0 striping
+# over IDE disks 1 and 2 (see bstripe in bio.c):
+# chunks of the image go alternately to the two outputs,
+# and the superblock records the chunk size.
+#
+#   stripe.pl chunk fs.img fs1.img fs2.img
+
+@ARGV == 4 or die "usage: stripe.pl chunk fs.img fs1.img fs2.img\n";
+($chunk, $in, $out1, $out2) = @ARGV;
+$chunk >= 2 or die "chunk must be at least 2 sectors\n";
+
+open(IN, "<$in") or die "open $in: $!\n";
+binmode IN;
+$n = sysread(IN, $img, -s $in);
+$n == -s $in or die "read $in: $!\n";
+close IN;
+
+# superblock: block 1, field stripe at byte 12, bsize at byte 24.
+# Find the block size by looking for a superblock that names it.
+$bsize = 512;
+for($b = 4096; $b > 512; $b -= 512){
+  if(length($img) >= $b+28 && unpack("V", substr($img, $b+24, 4)) == $b){
+    $bsize = $b;
+    last;
+  }
+}
+$chunk % ($bsize/512) == 0 or die "chunk must be a multiple of the block size\n";
+substr($img, $bsize+12, 4) = pack("V", $chunk);
+
+@out = ("", "");
+for($i = 0, $off = 0; $off < length($img); $i++, $off += $chunk*512){
+  $out[$i % 2] .= substr($img, $off, $chunk*512);
+}
+
+foreach $f ([$out1, $out[0]], [$out2, $out[1]]){
+  open(OUT, ">$f->[0]") or die "open $f->[0]: $!\n";
+  binmode OUT;
+  print OUT $f->[1];
+  close OUT;
+}
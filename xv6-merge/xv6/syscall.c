@@ -106,6 +106,24 @@ extern int sys_waitForDecode(void);
 extern int sys_beginDecode(void);
 extern int sys_endDecode(void);
 extern int sys_getCoreBuf(void);
+extern int sys_sync(void);
+extern int sys_fsync(void);
+extern int sys_iostat(void);
+extern int sys_splice(void);
+extern int sys_vmsplice(void);
+extern int sys_copy_file_range(void);
+extern int sys_rename(void);
+extern int sys_getdents(void);
+extern int sys_poll(void);
+extern int sys_fcntl(void);
+extern int sys_lseek(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_ioring_setup(void);
+extern int sys_ioring_enter(void);
+extern int sys_ulimit(void);
 
 static int (*syscalls[])(void) = {
 [SYS_chdir]   sys_chdir,
@@ -137,6 +155,24 @@ static int (*syscalls[])(void) = {
 [SYS_waitForDecode] sys_waitForDecode,
 [SYS_endDecode] sys_endDecode,
 [SYS_getCoreBuf] sys_getCoreBuf,
+[SYS_sync]    sys_sync,
+[SYS_fsync]   sys_fsync,
+[SYS_iostat]  sys_iostat,
+[SYS_splice]  sys_splice,
+[SYS_vmsplice] sys_vmsplice,
+[SYS_copy_file_range] sys_copy_file_range,
+[SYS_rename]  sys_rename,
+[SYS_getdents] sys_getdents,
+[SYS_poll]    sys_poll,
+[SYS_fcntl]   sys_fcntl,
+[SYS_lseek]   sys_lseek,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_ioring_setup] sys_ioring_setup,
+[SYS_ioring_enter] sys_ioring_enter,
+[SYS_ulimit]  sys_ulimit,
 };
 
 void
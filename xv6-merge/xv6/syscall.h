@@ -28,3 +28,21 @@
 #define SYS_waitForDecode 27
 #define SYS_endDecode 28
 #define SYS_getCoreBuf 29
+#define SYS_sync   30
+#define SYS_fsync  31
+#define SYS_iostat 32
+#define SYS_splice 33
+#define SYS_vmsplice 34
+#define SYS_copy_file_range 35
+#define SYS_rename 36
+#define SYS_getdents 37
+#define SYS_poll   38
+#define SYS_fcntl  39
+#define SYS_lseek  40
+#define SYS_pread  41
+#define SYS_pwrite 42
+#define SYS_readv  43
+#define SYS_writev 44
+#define SYS_ioring_setup 45
+#define SYS_ioring_enter 46
+#define SYS_ulimit 47
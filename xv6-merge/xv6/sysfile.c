@@ -18,7 +18,7 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=proc->ofile[fd]) == 0)
+  if((f=fdget(fd)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -27,22 +27,6 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
-// Allocate a file descriptor for the given file.
-// Takes over file reference from caller on success.
-static int
-fdalloc(struct file *f)
-{
-  int fd;
-
-  for(fd = 0; fd < NOFILE; fd++){
-    if(proc->ofile[fd] == 0){
-      proc->ofile[fd] = f;
-      return fd;
-    }
-  }
-  return -1;
-}
-
 int
 sys_dup(void)
 {
@@ -89,7 +73,7 @@ sys_close(void)
   
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  proc->ofile[fd] = 0;
+  fdclear(fd);
   fileclose(f);
   return 0;
 }
@@ -105,20 +89,64 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Write all delayed writes out to disk.
+int
+sys_sync(void)
+{
+  log_sync();
+  pcsync();
+  bsync();
+  return 0;
+}
+
+// Make sure fd's data and metadata are on disk.
+// The caches do not track which blocks belong to which
+// file, so this commits the log and writes back all file
+// data, even when there is nothing to commit.
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  log_sync();
+  pcsync();
+  return 0;
+}
+
+// Report disk traffic and page cache use.
+int
+sys_iostat(void)
+{
+  struct iostat *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  biostat(st);
+  pcstat(st);
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 int
 sys_link(void)
 {
-  char name[DIRSIZ], *new, *old;
+  char name[MAXNAME+1], *new, *old;
   struct inode *dp, *ip;
 
   if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
     return -1;
-  if((ip = namei(old)) == 0)
+
+  begin_op();
+  if((ip = namei(old)) == 0){
+    end_op();
     return -1;
+  }
   ilock(ip);
   if(ip->type == T_DIR){
     iunlockput(ip);
+    end_op();
     return -1;
   }
   ip->nlink++;
@@ -134,6 +162,7 @@ sys_link(void)
   }
   iunlockput(dp);
   iput(ip);
+  end_op();
   return 0;
 
 bad:
@@ -141,62 +170,43 @@ bad:
   ip->nlink--;
   iupdate(ip);
   iunlockput(ip);
+  end_op();
   return -1;
 }
 
-// Is the directory dp empty except for "." and ".." ?
-static int
-isdirempty(struct inode *dp)
-{
-  int off;
-  struct dirent de;
-
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
-  }
-  return 1;
-}
-
 int
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
-  char name[DIRSIZ], *path;
+  char name[MAXNAME+1], *path;
   uint off;
 
   if(argstr(0, &path) < 0)
     return -1;
-  if((dp = nameiparent(path, name)) == 0)
+
+  begin_op();
+  if((dp = nameiparent(path, name)) == 0){
+    end_op();
     return -1;
+  }
   ilock(dp);
 
   // Cannot unlink "." or "..".
-  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
-    iunlockput(dp);
-    return -1;
-  }
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0)
+    goto bad;
 
-  if((ip = dirlookup(dp, name, &off)) == 0){
-    iunlockput(dp);
-    return -1;
-  }
+  if((ip = dirlookup(dp, name, &off)) == 0)
+    goto bad;
   ilock(ip);
 
   if(ip->nlink < 1)
     panic("unlink: nlink < 1");
   if(ip->type == T_DIR && !isdirempty(ip)){
     iunlockput(ip);
-    iunlockput(dp);
-    return -1;
+    goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -206,7 +216,37 @@ sys_unlink(void)
   ip->nlink--;
   iupdate(ip);
   iunlockput(ip);
+  end_op();
   return 0;
+
+bad:
+  iunlockput(dp);
+  end_op();
+  return -1;
+}
+
+// Rename the path old to new, replacing new if it exists.
+int
+sys_rename(void)
+{
+  char oname[MAXNAME+1], nname[MAXNAME+1], *old, *new;
+  struct inode *odp, *ndp;
+  int r;
+
+  if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
+    return -1;
+
+  begin_op();
+  r = -1;
+  if((odp = nameiparent(old, oname)) != 0){
+    if((ndp = nameiparent(new, nname)) != 0){
+      r = dirrename(odp, oname, ndp, nname);
+      iput(ndp);
+    }
+    iput(odp);
+  }
+  end_op();
+  return r;
 }
 
 static struct inode*
@@ -214,7 +254,7 @@ create(char *path, short type, short major, short minor)
 {
   uint off;
   struct inode *ip, *dp;
-  char name[DIRSIZ];
+  char name[MAXNAME+1];
 
   if((dp = nameiparent(path, name)) == 0)
     return 0;
@@ -229,7 +269,7 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
+  if((ip = ialloc(dp->dev, type, dp->inum)) == 0)
     panic("create: ialloc");
 
   ilock(ip);
@@ -263,15 +303,22 @@ sys_open(void)
 
   if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
     return -1;
+
+  begin_op();
   if(omode & O_CREATE){
-    if((ip = create(path, T_FILE, 0, 0)) == 0)
+    if((ip = create(path, T_FILE, 0, 0)) == 0){
+      end_op();
       return -1;
+    }
   } else {
-    if((ip = namei(path)) == 0)
+    if((ip = namei(path)) == 0){
+      end_op();
       return -1;
+    }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
+      end_op();
       return -1;
     }
   }
@@ -280,15 +327,18 @@ sys_open(void)
     if(f)
       fileclose(f);
     iunlockput(ip);
+    end_op();
     return -1;
   }
   iunlock(ip);
+  end_op();
 
   f->type = FD_INODE;
   f->ip = ip;
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
   return fd;
 }
 
@@ -298,9 +348,13 @@ sys_mkdir(void)
   char *path;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0)
+  begin_op();
+  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+    end_op();
     return -1;
+  }
   iunlockput(ip);
+  end_op();
   return 0;
 }
 
@@ -312,12 +366,16 @@ sys_mknod(void)
   int len;
   int major, minor;
   
+  begin_op();
   if((len=argstr(0, &path)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
-     (ip = create(path, T_DEV, major, minor)) == 0)
+     (ip = create(path, T_DEV, major, minor)) == 0){
+    end_op();
     return -1;
+  }
   iunlockput(ip);
+  end_op();
   return 0;
 }
 
@@ -327,15 +385,20 @@ sys_chdir(void)
   char *path;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0)
+  begin_op();
+  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
+    end_op();
     return -1;
+  }
   ilock(ip);
   if(ip->type != T_DIR){
     iunlockput(ip);
+    end_op();
     return -1;
   }
   iunlock(ip);
   iput(proc->cwd);
+  end_op();
   proc->cwd = ip;
   return 0;
 }
@@ -380,7 +443,7 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      proc->ofile[fd0] = 0;
+      fdclear(fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -389,3 +452,257 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+// Move up to n bytes from fd_in to fd_out, at least one of
+// which is a pipe, without copying them through user space.
+int
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
+// Write n bytes at addr to the pipe fd.  Whole pages are not
+// copied: the pipe shares them with the process, which must
+// not change them until they have been read.
+int
+sys_vmsplice(void)
+{
+  struct file *f;
+  char *p, *mem;
+  int n, i, m, r;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+    return -1;
+  if(f->type != FD_PIPE || f->writable == 0)
+    return -1;
+  for(i = 0; i < n; i += m){
+    m = PGSIZE - (uint)(p + i) % PGSIZE;
+    if(m > n - i)
+      m = n - i;
+    if(m == PGSIZE && (mem = uva2ka(proc->pgdir, p + i)) != 0){
+      if(pipereserve(f->pipe, f->nonblock) < 0)
+        break;
+      kdup(mem);
+      if(pipeputpage(f->pipe, mem, 0, PGSIZE) < 0){
+        kfree(mem);
+        break;
+      }
+    } else if((r = pipewrite(f->pipe, p + i, m, f->nonblock)) < m){
+      // Full, with O_NONBLOCK: stop at what fit.
+      if(r > 0)
+        i += r;
+      break;
+    }
+  }
+  return i > 0 || n == 0 ? i : -1;
+}
+
+// Copy up to n bytes from file fd_in to file fd_out
+// inside the kernel.
+int
+sys_copy_file_range(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filecopy(in, out, n);
+}
+
+// Fill buf, n bytes, with struct dents for the next entries
+// of the directory open on fd, with their types and sizes.
+int
+sys_getdents(void)
+{
+  struct file *f;
+  int n, r;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+    return -1;
+  if(f->type != FD_INODE || f->readable == 0)
+    return -1;
+  begin_op();
+  r = dirread(f->ip, &f->off, p, n);
+  end_op();
+  return r;
+}
+
+// Wait until one of the n files in fds is ready for the events
+// asked for, or for timeout clock ticks; -1 waits for ever.
+// Returns how many files have events in revents.
+int
+sys_poll(void)
+{
+  struct pollfd *fds;
+  struct file *f;
+  int n, timeout, i, nready;
+  uint seq, deadline;
+
+  if(argint(1, &n) < 0 || n < 0 || n > NOFILEMAX || argint(2, &timeout) < 0 ||
+     argptr(0, (void*)&fds, n*sizeof(*fds)) < 0)
+    return -1;
+  deadline = ticks + timeout;
+  for(;;){
+    seq = pollstart();
+    nready = 0;
+    for(i = 0; i < n; i++){
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;
+      if((f = fdget(fds[i].fd)) == 0)
+        fds[i].revents = POLLNVAL;
+      else
+        fds[i].revents = filepoll(f) & (fds[i].events | POLLHUP | POLLERR);
+      if(fds[i].revents)
+        nready++;
+    }
+    if(nready > 0 || timeout == 0 || proc->killed ||
+       (timeout > 0 && (int)(ticks - deadline) >= 0)){
+      pollstop();
+      return proc->killed ? -1 : nready;
+    }
+    pollsleep(seq, timeout > 0, deadline);
+    pollstop();
+  }
+}
+
+// Get or set the O_ flags of fd; only O_NONBLOCK can be set.
+int
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  switch(cmd){
+  case F_GETFL:
+    return (f->readable ? (f->writable ? O_RDWR : O_RDONLY) : O_WRONLY) |
+           (f->nonblock ? O_NONBLOCK : 0);
+  case F_SETFL:
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
+  }
+  return -1;
+}
+
+// Set the offset of fd to off from whence (SEEK_SET,
+// SEEK_CUR or SEEK_END) and return it.
+int
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &whence) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
+
+// Read n bytes from fd at offset off, which is left alone.
+int
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+// Write n bytes to fd at offset off, which is left alone.
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+// Fetch the array of cnt iovecs that is the nth argument,
+// and check that every segment lies in the process and that
+// the total fits in the int the call returns.
+static int
+argiov(int n, int cnt, struct iovec **piov)
+{
+  struct iovec *iov;
+  uint tot;
+  int i;
+
+  if(cnt < 0 || cnt > NIOV || argptr(n, (void*)&iov, cnt*sizeof(*iov)) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if(iov[i].iov_len < 0 || (uint)iov[i].iov_base >= proc->sz ||
+       iov[i].iov_len > proc->sz - (uint)iov[i].iov_base)
+      return -1;
+    if((tot += iov[i].iov_len) > 0x7fffffff)
+      return -1;
+  }
+  *piov = iov;
+  return 0;
+}
+
+// Read from fd into the cnt segments of iov in turn.
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec *iov;
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiov(1, cnt, &iov) < 0)
+    return -1;
+  return filereadv(f, iov, cnt);
+}
+
+// Write the cnt segments of iov to fd in turn.
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec *iov;
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiov(1, cnt, &iov) < 0)
+    return -1;
+  return filewritev(f, iov, cnt);
+}
+
+// Return the limit on resource, and set it to limit if that
+// is not negative.  A lower limit leaves open files open.
+int
+sys_ulimit(void)
+{
+  int resource, limit, old;
+
+  if(argint(0, &resource) < 0 || argint(1, &limit) < 0)
+    return -1;
+  switch(resource){
+  case RLIMIT_NOFILE:
+    if(limit > NOFILEMAX)
+      return -1;
+    old = proc->fdt.max;
+    if(limit >= 0)
+      proc->fdt.max = limit;
+    return old;
+  case RLIMIT_NFILE:
+    return filelimit(limit);
+  }
+  return -1;
+}
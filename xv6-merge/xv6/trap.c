@@ -51,15 +51,21 @@ trap(struct trapframe *tf)
       ticks++;
       wakeup(&ticks);
       release(&tickslock);
+      polltick();
     }
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_SOUND:
-    soundInterrupt();
+    if(!virtiointr())  // the line may be shared with the virtio disk
+      soundInterrupt();
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
-    ideintr();
+    ideintr(0);
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_IDE2:
+    ideintr(1);
     lapiceoi();
     break;
   //kbd trap
@@ -84,6 +90,11 @@ trap(struct trapframe *tf)
     break;
    
   default:
+    if(virtioirq && tf->trapno == T_IRQ0 + virtioirq){
+      virtiointr();
+      lapiceoi();
+      break;
+    }
     if(proc == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
@@ -35,6 +35,7 @@
 #define IRQ_SOUND       11
 #define IRQ_MOUS 		12
 #define IRQ_IDE         14
+#define IRQ_IDE2        15
 #define IRQ_ERROR       19
 #define IRQ_SPURIOUS    31
 
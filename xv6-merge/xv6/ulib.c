@@ -3,6 +3,7 @@
 #include "fcntl.h"
 #include "user.h"
 #include "x86.h"
+#include "fs.h"
 
 char*
 strcpy(char *s, char *t)
@@ -49,12 +50,23 @@ strchr(const char *s, char c)
   return 0;
 }
 
+// Read a line from fd 0.  A read of the console stops at the
+// end of a line, so it takes the whole line at once; from a
+// file or pipe, read a byte at a time, so as not to take input
+// that belongs to whatever reads fd 0 next.
 char*
 gets(char *buf, int max)
 {
   int i, cc;
   char c;
+  struct stat st;
 
+  if(max > 1 && fstat(0, &st) == 0 && st.type == T_DEV){
+    if((cc = read(0, buf, max-1)) < 0)
+      cc = 0;
+    buf[cc] = '\0';
+    return buf;
+  }
   for(i=0; i+1 < max; ){
     cc = read(0, &c, 1);
     if(cc < 1)
@@ -92,6 +104,21 @@ atoi(const char *s)
   return n;
 }
 
+int
+memcmp(const void *v1, const void *v2, uint n)
+{
+  const uchar *s1, *s2;
+
+  s1 = v1;
+  s2 = v2;
+  while(n-- > 0){
+    if(*s1 != *s2)
+      return *s1 - *s2;
+    s1++, s2++;
+  }
+  return 0;
+}
+
 void*
 memmove(void *vdst, void *vsrc, int n)
 {
@@ -103,3 +130,38 @@ memmove(void *vdst, void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// Directory reading state: a batch of entries of the directory
+// open on dir.fd, so readdir handles one directory at a time.
+static struct {
+  int fd;
+  int n;         // bytes in buf
+  int off;       // next entry in buf
+  char buf[BSIZE];
+} dir = { -1 };
+
+// Read the next entry of the directory open on fd into *inum
+// and name, which must have room for MAXNAME+1 bytes.
+// Returns 1, or 0 at the end.
+int
+readdir(int fd, uint *inum, char *name)
+{
+  struct dent *d;
+
+  if(dir.fd != fd){
+    dir.fd = fd;
+    dir.n = dir.off = 0;
+  }
+  if(dir.off >= dir.n){
+    if((dir.n = getdents(fd, dir.buf, sizeof(dir.buf))) <= 0){
+      dir.fd = -1;
+      return 0;
+    }
+    dir.off = 0;
+  }
+  d = (struct dent*)(dir.buf + dir.off);
+  dir.off += d->reclen;
+  *inum = d->inum;
+  strcpy(name, d->name);
+  return 1;
+}
@@ -1,8 +1,13 @@
 struct stat;
+struct iostat;
+struct pollfd;
+struct iovec;
+struct ioring;
+typedef struct iobuf FILE;
 
 // system calls
 int fork(void);
-int exit(void) __attribute__((noreturn));
+int _exit(void) __attribute__((noreturn));
 int wait(void);
 int pipe(int*);
 int kwrite(void*, int);
@@ -30,17 +35,58 @@ int beginDecode();
 int waitForDecode();
 int endDecode();
 int getCoreBuf();
+int sync(void);
+int fsync(int);
+int iostat(struct iostat*);
+int splice(int, int, int);
+int vmsplice(int, void*, int);
+int copy_file_range(int, int, int);
+int rename(char*, char*);
+int getdents(int, void*, int);
+int poll(struct pollfd*, int, int);
+int fcntl(int, int, int);
+int lseek(int, int, int);
+int pread(int, void*, int, int);
+int pwrite(int, void*, int, int);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int ioring_setup(struct ioring*);
+int ioring_enter(int);
+int ulimit(int, int);
 
 // ulib.c
 int stat(char*, struct stat*);
 char* strcpy(char*, char*);
 void *memmove(void*, void*, int);
+int memcmp(const void*, const void*, uint);
 char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
-void printf(int, char*, ...);
 char* gets(char*, int max);
 uint strlen(char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+int readdir(int, uint*, char*);
+
+// printf.c
+void printf(int, char*, ...);
+void fprintf(FILE*, char*, ...);
+
+// stdio.c
+#define _IOFBF 0  // write when the buffer fills
+#define _IOLBF 1  // and at the end of each line
+#define _IONBF 2  // at once
+extern FILE *stdin, *stdout, *stderr;
+int exit(void) __attribute__((noreturn));
+FILE* fopen(char*, char*);
+FILE* fdopen(int, char*);
+int fclose(FILE*);
+int fflush(FILE*);
+int setvbuf(FILE*, char*, int, uint);
+uint fread(void*, uint, uint, FILE*);
+uint fwrite(void*, uint, uint, FILE*);
+int fgetc(FILE*);
+char* fgets(char*, int, FILE*);
+int fputc(int, FILE*);
+int fputs(char*, FILE*);
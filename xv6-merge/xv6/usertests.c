@@ -3,13 +3,14 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "ioring.h"
+#include "param.h"
 #include "syscall.h"
 #include "traps.h"
 
 char buf[2048];
 char name[3];
 char *echoargv[] = { "echo", "ALL", "TESTS", "PASSED", 0 };
-int stdout = 1;
 
 // simple file system tests
 
@@ -18,19 +19,19 @@ opentest(void)
 {
   int fd;
 
-  printf(stdout, "open test\n");
+  printf(1, "open test\n");
   fd = open("echo", 0);
   if(fd < 0){
-    printf(stdout, "open echo failed!\n");
+    printf(1, "open echo failed!\n");
     exit();
   }
   close(fd);
   fd = open("doesnotexist", 0);
   if(fd >= 0){
-    printf(stdout, "open doesnotexist succeeded!\n");
+    printf(1, "open doesnotexist succeeded!\n");
     exit();
   }
-  printf(stdout, "open test ok\n");
+  printf(1, "open test ok\n");
 }
 
 void
@@ -39,47 +40,47 @@ writetest(void)
   int fd;
   int i;
 
-  printf(stdout, "small file test\n");
+  printf(1, "small file test\n");
   fd = open("small", O_CREATE|O_RDWR);
   if(fd >= 0){
-    printf(stdout, "creat small succeeded; ok\n");
+    printf(1, "creat small succeeded; ok\n");
   } else {
-    printf(stdout, "error: creat small failed!\n");
+    printf(1, "error: creat small failed!\n");
     exit();
   }
   for(i = 0; i < 100; i++) {
     if(write(fd, "aaaaaaaaaa", 10) != 10) {
-      printf(stdout, "error: write aa %d new file failed\n", i);
+      printf(1, "error: write aa %d new file failed\n", i);
       exit();
     }
     if(write(fd, "bbbbbbbbbb", 10) != 10) {
-      printf(stdout, "error: write bb %d new file failed\n", i);
+      printf(1, "error: write bb %d new file failed\n", i);
       exit();
     }
   }
-  printf(stdout, "writes ok\n");
+  printf(1, "writes ok\n");
   close(fd);
   fd = open("small", O_RDONLY);
   if(fd >= 0){
-    printf(stdout, "open small succeeded ok\n");
+    printf(1, "open small succeeded ok\n");
   } else {
-    printf(stdout, "error: open small failed!\n");
+    printf(1, "error: open small failed!\n");
     exit();
   }
   i = read(fd, buf, 2000);
   if(i == 2000) {
-    printf(stdout, "read succeeded ok\n");
+    printf(1, "read succeeded ok\n");
   } else {
-    printf(stdout, "read failed\n");
+    printf(1, "read failed\n");
     exit();
   }
   close(fd);
 
   if(unlink("small") < 0) {
-    printf(stdout, "unlink small failed\n");
+    printf(1, "unlink small failed\n");
     exit();
   }
-  printf(stdout, "small file test ok\n");
+  printf(1, "small file test ok\n");
 }
 
 void
@@ -87,18 +88,18 @@ writetest1(void)
 {
   int i, fd, n;
 
-  printf(stdout, "big files test\n");
+  printf(1, "big files test\n");
 
   fd = open("big", O_CREATE|O_RDWR);
   if(fd < 0){
-    printf(stdout, "error: creat big failed!\n");
+    printf(1, "error: creat big failed!\n");
     exit();
   }
 
   for(i = 0; i < MAXFILE; i++) {
     ((int*) buf)[0] = i;
     if(write(fd, buf, 512) != 512) {
-      printf(stdout, "error: write big file failed\n", i);
+      printf(1, "error: write big file failed\n", i);
       exit();
     }
   }
@@ -107,7 +108,7 @@ writetest1(void)
 
   fd = open("big", O_RDONLY);
   if(fd < 0){
-    printf(stdout, "error: open big failed!\n");
+    printf(1, "error: open big failed!\n");
     exit();
   }
 
@@ -116,16 +117,16 @@ writetest1(void)
     i = read(fd, buf, 512);
     if(i == 0) {
       if(n == MAXFILE - 1) {
-        printf(stdout, "read only %d blocks from big", n);
+        printf(1, "read only %d blocks from big", n);
         exit();
       }
       break;
     } else if(i != 512) {
-      printf(stdout, "read failed %d\n", i);
+      printf(1, "read failed %d\n", i);
       exit();
     }
     if(((int*)buf)[0] != n) {
-      printf(stdout, "read content of block %d is %d\n",
+      printf(1, "read content of block %d is %d\n",
              n, ((int*)buf)[0]);
       exit();
     }
@@ -133,10 +134,95 @@ writetest1(void)
   }
   close(fd);
   if(unlink("big") < 0) {
-    printf(stdout, "unlink big failed\n");
+    printf(1, "unlink big failed\n");
     exit();
   }
-  printf(stdout, "big files ok\n");
+  printf(1, "big files ok\n");
+}
+
+// rewrite the same block many times with delayed writes,
+// then force it out with fsync and sync.
+void
+synctest(void)
+{
+  int i, fd;
+
+  printf(1, "sync test\n");
+
+  fd = open("syncf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "error: creat syncf failed!\n");
+    exit();
+  }
+  for(i = 0; i < 100; i++){
+    close(fd);
+    fd = open("syncf", O_RDWR);
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, 512) != 512){
+      printf(1, "error: write syncf failed\n");
+      exit();
+    }
+  }
+  if(fsync(fd) < 0 || fsync(-1) >= 0){
+    printf(1, "error: fsync\n");
+    exit();
+  }
+  close(fd);
+  if(sync() < 0){
+    printf(1, "error: sync failed\n");
+    exit();
+  }
+
+  fd = open("syncf", O_RDONLY);
+  if(read(fd, buf, 512) != 512 || ((int*)buf)[0] != 99){
+    printf(1, "error: syncf has wrong contents\n");
+    exit();
+  }
+  close(fd);
+  unlink("syncf");
+  printf(1, "sync test ok\n");
+}
+
+// a small file lives in its inode until it grows
+// past NINLINE bytes, then moves to a block.
+void
+smallfile(void)
+{
+  int fd, i, j, n;
+
+  printf(1, "small file test\n");
+
+  fd = open("smallf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "error: creat smallf failed!\n");
+    exit();
+  }
+  for(i = 0; i < 2*NINLINE; i += n){
+    n = NINLINE/2 + 1;
+    for(j = 0; j < n; j++)
+      buf[j] = 'a' + (i+j)%26;
+    if(write(fd, buf, n) != n){
+      printf(1, "error: write smallf failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  fd = open("smallf", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  if(n != i){
+    printf(1, "error: read smallf got %d bytes, not %d\n", n, i);
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if(buf[i] != 'a' + i%26){
+      printf(1, "error: smallf has wrong contents at %d\n", i);
+      exit();
+    }
+  }
+  unlink("smallf");
+  printf(1, "small file test ok\n");
 }
 
 void
@@ -144,7 +230,7 @@ createtest(void)
 {
   int i, fd;
 
-  printf(stdout, "many creates, followed by unlink test\n");
+  printf(1, "many creates, followed by unlink test\n");
 
   name[0] = 'a';
   name[2] = '\0';
@@ -159,41 +245,41 @@ createtest(void)
     name[1] = '0' + i;
     unlink(name);
   }
-  printf(stdout, "many creates, followed by unlink; ok\n");
+  printf(1, "many creates, followed by unlink; ok\n");
 }
 
 void dirtest(void)
 {
-  printf(stdout, "mkdir test\n");
+  printf(1, "mkdir test\n");
 
   if(mkdir("dir0") < 0) {
-    printf(stdout, "mkdir failed\n");
+    printf(1, "mkdir failed\n");
     exit();
   }
 
   if(chdir("dir0") < 0) {
-    printf(stdout, "chdir dir0 failed\n");
+    printf(1, "chdir dir0 failed\n");
     exit();
   }
 
   if(chdir("..") < 0) {
-    printf(stdout, "chdir .. failed\n");
+    printf(1, "chdir .. failed\n");
     exit();
   }
 
   if(unlink("dir0") < 0) {
-    printf(stdout, "unlink dir0 failed\n");
+    printf(1, "unlink dir0 failed\n");
     exit();
   }
-  printf(stdout, "mkdir test\n");
+  printf(1, "mkdir test\n");
 }
 
 void
 exectest(void)
 {
-  printf(stdout, "exec test\n");
+  printf(1, "exec test\n");
   if(exec("echo", echoargv) < 0) {
-    printf(stdout, "exec echo failed\n");
+    printf(1, "exec echo failed\n");
     exit();
   }
 }
@@ -250,6 +336,726 @@ pipe1(void)
   printf(1, "pipe1 ok\n");
 }
 
+// a pipe grows while the writer runs ahead of a slow reader,
+// and keeps the data in order as it wraps around.
+void
+bigpipe(void)
+{
+  int fds[2], pid;
+  int seq, i, n, total;
+
+  printf(1, "bigpipe test\n");
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  seq = 0;
+  if(pid == 0){
+    close(fds[0]);
+    for(total = 0; total < 3*PIPEMAX; total += 1000){
+      for(i = 0; i < 1000; i++)
+        buf[i] = seq++;
+      if(write(fds[1], buf, 1000) != 1000){
+        printf(1, "bigpipe write failed\n");
+        exit();
+      }
+    }
+    exit();
+  } else if(pid < 0){
+    printf(1, "fork() failed\n");
+    exit();
+  }
+  close(fds[1]);
+  sleep(1);  // let the writer fill the pipe
+  total = 0;
+  while((n = read(fds[0], buf, 777)) > 0){
+    for(i = 0; i < n; i++){
+      if((buf[i] & 0xff) != (seq++ & 0xff)){
+        printf(1, "bigpipe: wrong data at %d\n", total + i);
+        exit();
+      }
+    }
+    total += n;
+  }
+  close(fds[0]);
+  wait();
+  if(total != (3*PIPEMAX + 999) / 1000 * 1000){
+    printf(1, "bigpipe: read %d bytes\n", total);
+    exit();
+  }
+  printf(1, "bigpipe ok\n");
+}
+
+// Read fd to the end and check that it holds n bytes: the
+// pattern splicetest and copytest write, zeroed before zero,
+// repeating every size bytes.
+static void
+patterncheck(int fd, int n, int size, int zero, char *what)
+{
+  int i, j, m, total;
+
+  for(total = 0; (m = read(fd, buf, sizeof(buf))) > 0; total += m){
+    for(i = 0; i < m; i++){
+      j = (total + i) % size;
+      if((buf[i] & 0xff) != (j < zero ? 0 : j % 251)){
+        printf(1, "%s: wrong data at %d\n", what, total + i);
+        exit();
+      }
+    }
+  }
+  if(total != n){
+    printf(1, "%s: read %d bytes\n", what, total);
+    exit();
+  }
+}
+
+// splice moves pipe data into a file and file data into a
+// pipe, and vmsplice gives a pipe whole pages of memory, without
+// copies; a write to the file after it was spliced must not
+// change what the pipe holds.
+void
+splicetest(void)
+{
+  int fds[2], fd, i, size;
+  char *a;
+
+  printf(1, "splice test\n");
+  size = 3*4096 + 100;
+  a = sbrk(5*4096);
+  a += (4096 - (uint)a % 4096) % 4096;
+  for(i = 0; i < size; i++)
+    a[i] = i % 251;
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+
+  if(write(fds[1], a, size) != size){
+    printf(1, "splice: pipe write failed\n");
+    exit();
+  }
+  fd = open("splicef", O_CREATE|O_RDWR);
+  // The writer is still open: splice must not wait for more.
+  if(fd < 0 || splice(fds[0], fd, size + 4096) != size){
+    printf(1, "splice: pipe to file failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("splicef", 0);
+  if(splice(fd, fds[1], size + 10) != size){
+    printf(1, "splice: file to pipe failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("splicef", O_RDWR);
+  memset(buf, 0, sizeof(buf));
+  if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf(1, "splice: file write failed\n");
+    exit();
+  }
+  close(fd);
+
+  if(vmsplice(fds[1], a, size) != size){
+    printf(1, "vmsplice failed\n");
+    exit();
+  }
+  close(fds[1]);
+  patterncheck(fds[0], 2*size, size, 0, "splice pipe");
+  close(fds[0]);
+
+  fd = open("splicef", 0);
+  patterncheck(fd, size, size, sizeof(buf), "splice file");
+  close(fd);
+  unlink("splicef");
+  sbrk(-5*4096);
+  printf(1, "splice ok\n");
+}
+
+// copy_file_range shares whole pages and copies the rest
+// inside the kernel; a later write to the source must not
+// show in the copies.
+void
+copytest(void)
+{
+  int fd, fd2, i, j, n, size;
+
+  printf(1, "copy_file_range test\n");
+  size = 3*4096 + 100;
+  fd = open("copyf", O_CREATE|O_RDWR);
+  for(i = 0; i < size; i += n){
+    n = size - i < sizeof(buf) ? size - i : sizeof(buf);
+    for(j = 0; j < n; j++)
+      buf[j] = (i + j) % 251;
+    if(write(fd, buf, n) != n){
+      printf(1, "copytest: write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  fd = open("copyf", 0);
+  fd2 = open("copyf2", O_CREATE|O_RDWR);
+  if(copy_file_range(fd, fd2, size + 10) != size){
+    printf(1, "copy_file_range failed\n");
+    exit();
+  }
+  close(fd);
+  close(fd2);
+
+  fd = open("copyf", 0);
+  fd2 = open("copyf3", O_CREATE|O_RDWR);
+  if(read(fd, buf, 100) != 100 || write(fd2, buf, 100) != 100 ||
+     copy_file_range(fd, fd2, size) != size - 100){
+    printf(1, "unaligned copy_file_range failed\n");
+    exit();
+  }
+  close(fd);
+  close(fd2);
+
+  fd = open("copyf", O_RDWR);
+  memset(buf, 0, sizeof(buf));
+  if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf(1, "copytest: overwrite failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("copyf2", 0);
+  patterncheck(fd, size, size, 0, "copy");
+  close(fd);
+  fd = open("copyf3", 0);
+  patterncheck(fd, size, size, 0, "unaligned copy");
+  close(fd);
+  fd = open("copyf", 0);
+  patterncheck(fd, size, size, sizeof(buf), "copy source");
+  close(fd);
+  unlink("copyf");
+  unlink("copyf2");
+  unlink("copyf3");
+  printf(1, "copy_file_range ok\n");
+}
+
+// rename moves a name within and across directories, replaces
+// a file and only an empty directory, keeps ".." of a moved
+// directory right, and refuses to move a directory below itself.
+void
+renametest(void)
+{
+  int fd;
+
+  printf(1, "rename test\n");
+  fd = open("rn1", O_CREATE|O_RDWR);
+  write(fd, "abc", 3);
+  close(fd);
+  close(open("rn3", O_CREATE|O_RDWR));
+  if(rename("rn1", "rn2") != 0 || open("rn1", 0) >= 0){
+    printf(1, "rename rn1 rn2 failed\n");
+    exit();
+  }
+  if(rename("rn2", "rn3") != 0 || open("rn2", 0) >= 0){
+    printf(1, "rename over rn3 failed\n");
+    exit();
+  }
+  fd = open("rn3", 0);
+  if(fd < 0 || read(fd, buf, sizeof(buf)) != 3 || buf[0] != 'a'){
+    printf(1, "renamed rn3 has wrong data\n");
+    exit();
+  }
+  close(fd);
+
+  if(mkdir("rnd") != 0 || mkdir("rnd2") != 0 || mkdir("rnd3") != 0 ||
+     rename("rn3", "rnd/rn4") != 0 || rename("rnd", "rnd2/sub") != 0){
+    printf(1, "rename across directories failed\n");
+    exit();
+  }
+  if(chdir("rnd2/sub") != 0 || (fd = open("../sub/rn4", 0)) < 0){
+    printf(1, "moved directory has wrong ..\n");
+    exit();
+  }
+  close(fd);
+  chdir("/");
+  if(rename("rnd2", "rnd2/sub/x") == 0 || rename("rnd3", "rnd2") == 0 ||
+     rename("rnd3", "rnd2/sub/rn4") == 0 || rename("rnd2/sub/rn4", "rnd3") == 0){
+    printf(1, "bad rename succeeded\n");
+    exit();
+  }
+  if(rename("rnd3", "rnd2/sub") == 0){
+    printf(1, "rename over full directory succeeded\n");
+    exit();
+  }
+  if(unlink("rnd2/sub/rn4") != 0 || rename("rnd3", "rnd2/sub") != 0 ||
+     unlink("rnd2/sub") != 0 || unlink("rnd2") != 0){
+    printf(1, "rename over empty directory failed\n");
+    exit();
+  }
+  printf(1, "rename ok\n");
+}
+
+// getdents returns a directory's entries in a few calls,
+// with the types and sizes of their inodes.
+void
+getdentstest(void)
+{
+  static char dbuf[4096];
+  char name[8];
+  struct dent *d;
+  int fd, i, n, off, calls, seen;
+
+  printf(1, "getdents test\n");
+  if(mkdir("gd") != 0){
+    printf(1, "mkdir gd failed\n");
+    exit();
+  }
+  name[0] = 'g';
+  name[1] = 'd';
+  name[2] = '/';
+  name[5] = 0;
+  for(i = 0; i < 100; i++){
+    name[3] = '0' + i/10;
+    name[4] = '0' + i%10;
+    fd = open(name, O_CREATE|O_RDWR);
+    write(fd, buf, i);
+    close(fd);
+  }
+
+  fd = open("gd", 0);
+  calls = seen = 0;
+  while((n = getdents(fd, dbuf, sizeof(dbuf))) > 0){
+    calls++;
+    for(off = 0; off < n; off += d->reclen){
+      d = (struct dent*)(dbuf + off);
+      if(d->name[0] == '.'){
+        if(d->type != T_DIR){
+          printf(1, "getdents: %s is not a directory\n", d->name);
+          exit();
+        }
+        continue;
+      }
+      i = atoi(d->name);
+      if(d->type != T_FILE || d->size != i || strlen(d->name) != d->namelen){
+        printf(1, "getdents: wrong entry %s\n", d->name);
+        exit();
+      }
+      seen++;
+    }
+  }
+  close(fd);
+  if(n < 0 || seen != 100 || calls > 2){
+    printf(1, "getdents: %d entries in %d calls\n", seen, calls);
+    exit();
+  }
+
+  fd = open("gd", 0);
+  if(getdents(fd, dbuf, 8) != -1){
+    printf(1, "getdents: short buffer accepted\n");
+    exit();
+  }
+  close(fd);
+  for(i = 0; i < 100; i++){
+    name[3] = '0' + i/10;
+    name[4] = '0' + i%10;
+    unlink(name);
+  }
+  unlink("gd");
+  printf(1, "getdents ok\n");
+}
+
+// poll waits for any of several pipes, times out, reports
+// a closed writer, and O_NONBLOCK makes reads and writes of a
+// pipe return at once.
+void
+polltest(void)
+{
+  struct pollfd pfd[2];
+  int a[2], b[2], c[2], pid, n, t;
+
+  printf(1, "poll test\n");
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pfd[0].fd = a[0];
+  pfd[1].fd = b[0];
+  pfd[0].events = pfd[1].events = POLLIN;
+  t = uptime();
+  if(poll(pfd, 2, 0) != 0 || poll(pfd, 2, 3) != 0 || uptime() - t < 3){
+    printf(1, "poll: empty pipes ready\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid == 0){
+    sleep(2);
+    write(b[1], "x", 1);
+    exit();
+  }
+  if(poll(pfd, 2, -1) != 1 || pfd[0].revents != 0 || pfd[1].revents != POLLIN){
+    printf(1, "poll: wrong pipe ready\n");
+    exit();
+  }
+  wait();
+  read(b[0], buf, 1);
+
+  if(fcntl(a[0], F_SETFL, O_NONBLOCK) != 0 || fcntl(a[1], F_SETFL, O_NONBLOCK) != 0 ||
+     fcntl(a[0], F_GETFL, 0) != (O_RDONLY|O_NONBLOCK) || read(a[0], buf, 1) != -1){
+    printf(1, "poll: nonblocking read waited\n");
+    exit();
+  }
+  for(n = 0; n < 2*PIPEMAX; n += t)
+    if((t = write(a[1], buf, sizeof(buf))) < 0)
+      break;
+  if(n < PIPEMAX/2 || n >= 2*PIPEMAX){
+    printf(1, "poll: nonblocking write wrote %d\n", n);
+    exit();
+  }
+  pfd[0].fd = a[1];
+  pfd[0].events = POLLOUT;
+  if(poll(pfd, 1, 0) != 0){
+    printf(1, "poll: full pipe writable\n");
+    exit();
+  }
+  // vmsplice must count only what fit.
+  while(read(a[0], buf, sizeof(buf)) > 0)
+    ;
+  for(n = 0; (t = vmsplice(a[1], buf, sizeof(buf))) > 0; n += t)
+    ;
+  while((t = read(a[0], buf, sizeof(buf))) > 0)
+    n -= t;
+  if(n != 0){
+    printf(1, "poll: nonblocking vmsplice off by %d\n", n);
+    exit();
+  }
+  // Nor may splice into a full nonblocking pipe wait.
+  if(pipe(c) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  for(n = 0; (t = vmsplice(a[1], buf, sizeof(buf))) > 0; n += t)
+    ;
+  write(c[1], "abc", 3);
+  if(splice(c[0], a[1], 3) != -1 || read(c[0], buf, 3) != 3){
+    printf(1, "poll: splice into full pipe\n");
+    exit();
+  }
+  while((t = read(a[0], buf, sizeof(buf))) > 0)
+    n -= t;
+  if(n != 0){
+    printf(1, "poll: nonblocking splice off by %d\n", n);
+    exit();
+  }
+  close(c[0]);
+  close(c[1]);
+
+  close(b[1]);
+  pfd[0].fd = b[0];
+  pfd[0].events = POLLIN;
+  if(poll(pfd, 1, -1) != 1 || pfd[0].revents != POLLHUP){
+    printf(1, "poll: no POLLHUP\n");
+    exit();
+  }
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+  printf(1, "poll ok\n");
+}
+
+// lseek, pread and pwrite reach any offset of a file, and
+// readv and writev move several segments in one call, for
+// files and pipes.
+void
+seekiotest(void)
+{
+  struct iovec iov[3];
+  char a[4], b[16];
+  int fd, p[2];
+
+  printf(1, "seek io test\n");
+  fd = open("seekio", O_CREATE|O_RDWR);
+  iov[0].iov_base = "abc";
+  iov[0].iov_len = 3;
+  iov[1].iov_base = "";
+  iov[1].iov_len = 0;
+  iov[2].iov_base = "defgh";
+  iov[2].iov_len = 5;
+  if(writev(fd, iov, 3) != 8 || lseek(fd, 0, SEEK_CUR) != 8 ||
+     lseek(fd, 0, SEEK_END) != 8 || lseek(fd, 1, SEEK_END) != -1){
+    printf(1, "seekio: writev or lseek failed\n");
+    exit();
+  }
+  if(lseek(fd, 2, SEEK_SET) != 2 || read(fd, b, 3) != 3 || memcmp(b, "cde", 3) != 0){
+    printf(1, "seekio: read after lseek failed\n");
+    exit();
+  }
+  if(pread(fd, b, 4, 1) != 4 || memcmp(b, "bcde", 4) != 0 ||
+     pwrite(fd, "XY", 2, 0) != 2 || lseek(fd, 0, SEEK_CUR) != 5){
+    printf(1, "seekio: pread or pwrite failed\n");
+    exit();
+  }
+  lseek(fd, 0, SEEK_SET);
+  iov[0].iov_base = a;
+  iov[0].iov_len = sizeof(a);
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  if(readv(fd, iov, 2) != 8 || memcmp(a, "XYcd", 4) != 0 || memcmp(b, "efgh", 4) != 0){
+    printf(1, "seekio: readv failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("seekio");
+
+  if(pipe(p) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  if(lseek(p[0], 0, SEEK_SET) != -1 || pread(p[0], b, 1, 0) != -1){
+    printf(1, "seekio: pipe has an offset\n");
+    exit();
+  }
+  iov[0].iov_base = "12";
+  iov[0].iov_len = 2;
+  iov[1].iov_base = "345";
+  iov[1].iov_len = 3;
+  if(writev(p[1], iov, 2) != 5){
+    printf(1, "seekio: writev to pipe failed\n");
+    exit();
+  }
+  iov[0].iov_base = a;
+  iov[0].iov_len = 1;
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  if(readv(p[0], iov, 2) != 5 || a[0] != '1' || memcmp(b, "2345", 4) != 0){
+    printf(1, "seekio: readv from pipe failed\n");
+    exit();
+  }
+  close(p[0]);
+  close(p[1]);
+  printf(1, "seek io ok\n");
+}
+
+// ioring_enter hands a batch of submissions to the kernel in
+// one call and waits for as many completions as asked; those
+// that would wait are kept until they can finish.
+void
+ioringtest(void)
+{
+  static char rbuf[2*4096];
+  struct ioring *r;
+  struct iosqe *e;
+  struct iocqe *c;
+  char b[16];
+  int fd, p[2], i;
+
+  printf(1, "ioring test\n");
+  r = (struct ioring*)(((uint)rbuf + 4095) & ~4095);
+  if(ioring_setup(r) != 0){
+    printf(1, "ioring_setup failed\n");
+    exit();
+  }
+  fd = open("ioring", O_CREATE|O_RDWR);
+  e = &r->sq[r->sqtail++ % IORING_NSQ];
+  e->op = IOR_WRITE;
+  e->fd = fd;
+  e->addr = "hello";
+  e->len = 5;
+  e->off = -1;
+  e->data = 1;
+  e = &r->sq[r->sqtail++ % IORING_NSQ];
+  e->op = IOR_WRITE;
+  e->fd = fd;
+  e->addr = " world";
+  e->len = 6;
+  e->off = -1;
+  e->data = 2;
+  e = &r->sq[r->sqtail++ % IORING_NSQ];
+  e->op = IOR_FSYNC;
+  e->fd = fd;
+  e->data = 3;
+  if(ioring_enter(3) != 3 || r->cqtail - r->cqhead != 3){
+    printf(1, "ioring: batch not done\n");
+    exit();
+  }
+  for(i = 0; i < 3; i++){
+    c = &r->cq[r->cqhead++ % IORING_NCQ];
+    if(c->data != i+1 || c->res != (i == 0 ? 5 : i == 1 ? 6 : 0)){
+      printf(1, "ioring: completion %d wrong\n", i);
+      exit();
+    }
+  }
+
+  if(pipe(p) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  e = &r->sq[r->sqtail++ % IORING_NSQ];
+  e->op = IOR_POLL;
+  e->fd = p[0];
+  e->events = POLLIN;
+  e->data = 4;
+  e = &r->sq[r->sqtail++ % IORING_NSQ];
+  e->op = IOR_READ;
+  e->fd = p[0];
+  e->addr = b;
+  e->len = sizeof(b);
+  e->off = -1;
+  e->data = 5;
+  e = &r->sq[r->sqtail++ % IORING_NSQ];
+  e->op = IOR_READ;
+  e->fd = fd;
+  e->addr = buf;
+  e->len = 64;
+  e->off = 0;
+  e->data = 6;
+  if(ioring_enter(1) != 3 || r->cqtail - r->cqhead != 1 ||
+     r->cq[r->cqhead % IORING_NCQ].data != 6 ||
+     r->cq[r->cqhead % IORING_NCQ].res != 11 || memcmp(buf, "hello world", 11) != 0){
+    printf(1, "ioring: read of file not done\n");
+    exit();
+  }
+  r->cqhead++;
+  if(fork() == 0){
+    sleep(2);
+    write(p[1], "x", 1);
+    exit();
+  }
+  if(ioring_enter(2) != 0 || r->cqtail - r->cqhead != 2 ||
+     r->cq[r->cqhead % IORING_NCQ].data != 4 ||
+     r->cq[r->cqhead % IORING_NCQ].res != POLLIN ||
+     r->cq[(r->cqhead+1) % IORING_NCQ].data != 5 ||
+     r->cq[(r->cqhead+1) % IORING_NCQ].res != 1 || b[0] != 'x'){
+    printf(1, "ioring: pipe entries not done\n");
+    exit();
+  }
+  r->cqhead += 2;
+  wait();
+  r->cqhead -= 1000;
+  if(ioring_enter(0) != -1){
+    printf(1, "ioring: bad cqhead taken\n");
+    exit();
+  }
+  r->cqhead += 1000;
+  close(p[0]);
+  close(p[1]);
+  close(fd);
+  unlink("ioring");
+  printf(1, "ioring ok\n");
+}
+
+// Streams gather output into few writes and read it back by
+// lines; "w" starts a new file and "a" adds to its end.
+void
+stdiotest(void)
+{
+  FILE *fp;
+  char line[32];
+  int i, n;
+
+  printf(1, "stdio test\n");
+  if((fp = fopen("stdio", "w")) == 0){
+    printf(1, "fopen stdio failed\n");
+    exit();
+  }
+  for(i = 0; i < 200; i++)
+    fprintf(fp, "line %d\n", i);
+  fputs("last", fp);
+  fputc('\n', fp);
+  if(fclose(fp) != 0 || (fp = fopen("stdio", "a")) == 0){
+    printf(1, "stdio: fclose or fopen a failed\n");
+    exit();
+  }
+  fputs("appended\n", fp);
+  fclose(fp);
+
+  fp = fopen("stdio", "r");
+  for(i = 0; fgets(line, sizeof(line), fp); i++){
+    if(i < 200){
+      n = atoi(line + 5);
+      if(memcmp(line, "line ", 5) != 0 || n != i){
+        printf(1, "stdio: line %d is %s", i, line);
+        exit();
+      }
+    } else if(strcmp(line, i == 200 ? "last\n" : "appended\n") != 0){
+      printf(1, "stdio: line %d is %s", i, line);
+      exit();
+    }
+  }
+  fclose(fp);
+  if(i != 202){
+    printf(1, "stdio: %d lines\n", i);
+    exit();
+  }
+
+  // A shorter file in its place leaves nothing of the old one.
+  fp = fopen("stdio", "w");
+  fputs("x\n", fp);
+  fclose(fp);
+  fp = fopen("stdio", "r");
+  if(fread(line, 1, sizeof(line), fp) != 2 || line[0] != 'x'){
+    printf(1, "stdio: old contents left\n");
+    exit();
+  }
+  fclose(fp);
+  unlink("stdio");
+  printf(1, "stdio ok\n");
+}
+
+// A process can open far more than NOFILE files, gets the
+// lowest free fd each time, and passes them all to a child;
+// ulimit sets how many it and the system may open.
+void
+manyfdtest(void)
+{
+  int fd, i, p[2];
+  char c;
+
+  printf(1, "many fd test\n");
+  if(ulimit(RLIMIT_NOFILE, -1) != NOFILEMAX || ulimit(RLIMIT_NFILE, -1) != NFILE){
+    printf(1, "manyfd: wrong default limits\n");
+    exit();
+  }
+  for(i = 3; i < 200; i++){
+    if((fd = dup(1)) != i){
+      printf(1, "manyfd: dup gave %d, not %d\n", fd, i);
+      exit();
+    }
+  }
+  close(50);
+  close(17);
+  if(dup(1) != 17 || dup(1) != 50 || pipe(p) != 0 || p[0] != 200){
+    printf(1, "manyfd: not the lowest free fd\n");
+    exit();
+  }
+
+  if(fork() == 0){
+    write(p[1], "x", 1);
+    exit();
+  }
+  wait();
+  if(read(p[0], &c, 1) != 1 || c != 'x'){
+    printf(1, "manyfd: child lost its high fds\n");
+    exit();
+  }
+
+  ulimit(RLIMIT_NOFILE, 100);
+  close(60);
+  if(dup(1) != 60 || dup(1) != -1){
+    printf(1, "manyfd: RLIMIT_NOFILE not kept\n");
+    exit();
+  }
+  ulimit(RLIMIT_NOFILE, NOFILEMAX);
+  ulimit(RLIMIT_NFILE, 0);
+  fd = open("README", 0);
+  ulimit(RLIMIT_NFILE, NFILE);
+  if(fd >= 0){
+    printf(1, "manyfd: RLIMIT_NFILE not kept\n");
+    exit();
+  }
+  for(i = 3; i <= 201; i++)
+    close(i);
+  printf(1, "many fd ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -967,6 +1773,55 @@ subdir(void)
   printf(1, "subdir ok\n");
 }
 
+// write() calls bigger than a transaction's worth of
+// blocks, which the kernel splits up.
+void
+bigwrite(void)
+{
+  char *p;
+  int fd, sz, i;
+
+  printf(1, "bigwrite test\n");
+
+  p = malloc(80*512);
+  if(p == 0){
+    printf(1, "bigwrite: malloc failed\n");
+    exit();
+  }
+  unlink("bigwrite");
+  for(sz = 499; sz < 80*512; sz += 2471){
+    fd = open("bigwrite", O_CREATE | O_RDWR);
+    if(fd < 0){
+      printf(1, "cannot create bigwrite\n");
+      exit();
+    }
+    for(i = 0; i < sz; i++)
+      p[i] = sz + i;
+    if(write(fd, p, sz) != sz){
+      printf(1, "write(%d) failed\n", sz);
+      exit();
+    }
+    close(fd);
+    fd = open("bigwrite", O_RDONLY);
+    memset(p, 0, sz);
+    if(read(fd, p, sz) != sz){
+      printf(1, "read(%d) failed\n", sz);
+      exit();
+    }
+    for(i = 0; i < sz; i++){
+      if(p[i] != (char)(sz + i)){
+        printf(1, "bigwrite: wrong data at %d of %d\n", i, sz);
+        exit();
+      }
+    }
+    close(fd);
+    unlink("bigwrite");
+  }
+  free(p);
+
+  printf(1, "bigwrite ok\n");
+}
+
 void
 bigfile(void)
 {
@@ -1024,44 +1879,64 @@ bigfile(void)
 }
 
 void
-fourteen(void)
+longname(void)
 {
-  int fd;
+  int fd, i;
+  char name[MAXNAME+3], path[2*MAXNAME+2];
 
-  // DIRSIZ is 14.
-  printf(1, "fourteen test\n");
+  // Names may have up to MAXNAME bytes; longer ones are cut there.
+  printf(1, "longname test\n");
 
-  if(mkdir("12345678901234") != 0){
-    printf(1, "mkdir 12345678901234 failed\n");
+  if(mkdir("12345678901234") != 0 || mkdir("123456789012345") != 0){
+    printf(1, "mkdir 12345678901234 or 123456789012345 failed\n");
     exit();
   }
-  if(mkdir("12345678901234/123456789012345") != 0){
-    printf(1, "mkdir 12345678901234/123456789012345 failed\n");
+  if(mkdir("12345678901234") == 0){
+    printf(1, "mkdir 12345678901234 twice succeeded!\n");
     exit();
   }
-  fd = open("123456789012345/123456789012345/123456789012345", O_CREATE);
+
+  for(i = 0; i < MAXNAME; i++)
+    name[i] = 'a' + i%26;
+  name[MAXNAME] = 0;
+  strcpy(path, "123456789012345/");
+  strcpy(path+strlen(path), name);
+  fd = open(path, O_CREATE);
   if(fd < 0){
-    printf(1, "create 123456789012345/123456789012345/123456789012345 failed\n");
+    printf(1, "create long name failed\n");
     exit();
   }
   close(fd);
-  fd = open("12345678901234/12345678901234/12345678901234", 0);
+
+  // A longer name is the same file.
+  name[MAXNAME] = 'x';
+  name[MAXNAME+1] = 0;
+  strcpy(path+strlen("123456789012345/"), name);
+  fd = open(path, 0);
   if(fd < 0){
-    printf(1, "open 12345678901234/12345678901234/12345678901234 failed\n");
+    printf(1, "open too long name failed\n");
     exit();
   }
   close(fd);
 
-  if(mkdir("12345678901234/12345678901234") == 0){
-    printf(1, "mkdir 12345678901234/12345678901234 succeeded!\n");
+  // But the 14-byte prefix is not.
+  name[14] = 0;
+  strcpy(path+strlen("123456789012345/"), name);
+  if(open(path, 0) >= 0){
+    printf(1, "open 14-byte prefix succeeded!\n");
     exit();
   }
-  if(mkdir("123456789012345/12345678901234") == 0){
-    printf(1, "mkdir 12345678901234/123456789012345 succeeded!\n");
+
+  name[MAXNAME] = 0;
+  for(i = 0; i < MAXNAME; i++)
+    name[i] = 'a' + i%26;
+  strcpy(path+strlen("123456789012345/"), name);
+  if(unlink(path) != 0 || unlink("123456789012345") != 0 || unlink("12345678901234") != 0){
+    printf(1, "unlink long names failed\n");
     exit();
   }
 
-  printf(1, "fourteen ok\n");
+  printf(1, "longname ok\n");
 }
 
 void
@@ -1240,7 +2115,7 @@ sbrktest(void)
   int pid;
   char *oldbrk = sbrk(0);
 
-  printf(stdout, "sbrk test\n");
+  printf(1, "sbrk test\n");
 
   // can one sbrk() less than a page?
   char *a = sbrk(0);
@@ -1248,7 +2123,7 @@ sbrktest(void)
   for(i = 0; i < 5000; i++){
     char *b = sbrk(1);
     if(b != a){
-      printf(stdout, "sbrk test failed %d %x %x\n", i, a, b);
+      printf(1, "sbrk test failed %d %x %x\n", i, a, b);
       exit();
     }
     *b = 1;
@@ -1256,13 +2131,13 @@ sbrktest(void)
   }
   pid = fork();
   if(pid < 0){
-    printf(stdout, "sbrk test fork failed\n");
+    printf(1, "sbrk test fork failed\n");
     exit();
   }
   char *c = sbrk(1);
   c = sbrk(1);
   if(c != a + 1){
-    printf(stdout, "sbrk test failed post-fork\n");
+    printf(1, "sbrk test failed post-fork\n");
     exit();
   }
   if(pid == 0)
@@ -1274,7 +2149,7 @@ sbrktest(void)
   uint amt = (640 * 1024) - (uint) a;
   char *p = sbrk(amt);
   if(p != a){
-    printf(stdout, "sbrk test failed 640K test, p %x a %x\n", p, a);
+    printf(1, "sbrk test failed 640K test, p %x a %x\n", p, a);
     exit();
   }
   char *lastaddr = (char *)(640 * 1024 - 1);
@@ -1283,7 +2158,7 @@ sbrktest(void)
   // is one forbidden from allocating more than 640K?
   c = sbrk(4096);
   if(c != (char *) 0xffffffff){
-    printf(stdout, "sbrk allocated more than 640K, c %x\n", c);
+    printf(1, "sbrk allocated more than 640K, c %x\n", c);
     exit();
   }
 
@@ -1291,12 +2166,12 @@ sbrktest(void)
   a = sbrk(0);
   c = sbrk(-4096);
   if(c == (char *) 0xffffffff){
-    printf(stdout, "sbrk could not deallocate\n");
+    printf(1, "sbrk could not deallocate\n");
     exit();
   }
   c = sbrk(0);
   if(c != a - 4096){
-    printf(stdout, "sbrk deallocation produced wrong address, a %x c %x\n", a, c);
+    printf(1, "sbrk deallocation produced wrong address, a %x c %x\n", a, c);
     exit();
   }
 
@@ -1304,18 +2179,18 @@ sbrktest(void)
   a = sbrk(0);
   c = sbrk(4096);
   if(c != a || sbrk(0) != a + 4096){
-    printf(stdout, "sbrk re-allocation failed, a %x c %x\n", a, c);
+    printf(1, "sbrk re-allocation failed, a %x c %x\n", a, c);
     exit();
   }
   if(*lastaddr == 99){
     // should be zero
-    printf(stdout, "sbrk de-allocation didn't really deallocate\n");
+    printf(1, "sbrk de-allocation didn't really deallocate\n");
     exit();
   }
 
   c = sbrk(4096);
   if(c != (char *) 0xffffffff){
-    printf(stdout, "sbrk was able to re-allocate beyond 640K, c %x\n", c);
+    printf(1, "sbrk was able to re-allocate beyond 640K, c %x\n", c);
     exit();
   }
 
@@ -1324,11 +2199,11 @@ sbrktest(void)
     int ppid = getpid();
     int pid = fork();
     if(pid < 0){
-      printf(stdout, "fork failed\n");
+      printf(1, "fork failed\n");
       exit();
     }
     if(pid == 0){
-      printf(stdout, "oops could read %x = %x\n", a, *a);
+      printf(1, "oops could read %x = %x\n", a, *a);
       kill(ppid);
       exit();
     }
@@ -1366,14 +2241,14 @@ sbrktest(void)
     wait();
   }
   if(c == (char*)0xffffffff) {
-    printf(stdout, "failed sbrk leaked memory\n");
+    printf(1, "failed sbrk leaked memory\n");
     exit();
   }
 
   if(sbrk(0) > oldbrk)
     sbrk(-(sbrk(0) - oldbrk));
 
-  printf(stdout, "sbrk test OK\n");
+  printf(1, "sbrk test OK\n");
 }
 
 void
@@ -1394,7 +2269,7 @@ validatetest(void)
 {
   int hi = 1100*1024;
 
-  printf(stdout, "validate test\n");
+  printf(1, "validate test\n");
 
   uint p;
   for (p = 0; p <= (uint)hi; p += 4096) {
@@ -1411,12 +2286,12 @@ validatetest(void)
 
     // try to crash the kernel by passing in a bad string pointer
     if (link("nosuchfile", (char*)p) != -1) {
-      printf(stdout, "link should not succeed\n");
+      printf(1, "link should not succeed\n");
       exit();
     }
   }
 
-  printf(stdout, "validate ok\n");
+  printf(1, "validate ok\n");
 }
 
 int
@@ -1436,16 +2311,29 @@ main(int argc, char *argv[])
   opentest();
   writetest();
   writetest1();
+  synctest();
+  smallfile();
   createtest();
 
   mem();
   pipe1();
+  bigpipe();
+  splicetest();
+  copytest();
+  renametest();
+  getdentstest();
+  polltest();
+  seekiotest();
+  ioringtest();
+  stdiotest();
+  manyfdtest();
   preempt();
   exitwait();
 
   rmdot();
-  fourteen();
+  longname();
   bigfile();
+  bigwrite();
   subdir();
   concreate();
   linktest();
@@ -0,0 +1,308 @@
+// Virtio block device driver (legacy PCI interface).
+//
+// To run the file system on it under QEMU, replace -hdb fs.img with
+//   -drive file=fs.img,if=virtio,format=raw
+// (see the qemu-virtio target in the Makefile).
+//
+// Unlike the IDE driver, which feeds the disk one sector at a
+// time with PIO, requests are placed on a descriptor ring in memory
+// shared with the device, which works on all of them at once and
+// interrupts when some have finished.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "buf.h"
+
+// Legacy virtio PCI I/O registers, relative to BAR 0.
+#define VIRTIO_HOST_FEATURES  0x00
+#define VIRTIO_GUEST_FEATURES 0x04
+#define VIRTIO_QUEUE_PFN      0x08
+#define VIRTIO_QUEUE_NUM      0x0C
+#define VIRTIO_QUEUE_SEL      0x0E
+#define VIRTIO_QUEUE_NOTIFY   0x10
+#define VIRTIO_STATUS         0x12
+#define VIRTIO_ISR            0x13
+
+// Device status bits.
+#define VIRTIO_ACKNOWLEDGE    1
+#define VIRTIO_DRIVER         2
+#define VIRTIO_DRIVER_OK      4
+
+#define VRING_DESC_F_NEXT     1  // chained with another descriptor
+#define VRING_DESC_F_WRITE    2  // device writes (vs reads)
+
+#define VIRTIO_BLK_T_IN       0  // read the disk
+#define VIRTIO_BLK_T_OUT      1  // write the disk
+
+#define PCI_CONFIG_SPACE_STA_CMD 0x4
+#define PCI_CONFIG_SPACE_BAR0    0x10
+#define PCI_CONFIG_SPACE_INTRL   0x3C
+
+// The device picks the ring size; we can handle up to QMAX.
+#define QMAX 256
+
+struct vring_desc {
+  uint addr;
+  uint addrhi;
+  uint len;
+  ushort flags;
+  ushort next;
+};
+
+struct vring_avail {
+  ushort flags;
+  ushort idx;
+  ushort ring[];
+};
+
+struct vring_used_elem {
+  uint id;   // head of the completed descriptor chain
+  uint len;
+};
+
+struct vring_used {
+  ushort flags;
+  ushort idx;
+  struct vring_used_elem ring[];
+};
+
+// Request header: the first descriptor of every request.
+struct virtio_blk_req {
+  uint type;
+  uint reserved;
+  uint sector;
+  uint sectorhi;
+};
+
+// The legacy interface wants the rings in physically contiguous,
+// page-aligned memory: descriptors and available ring, then the
+// used ring on the next page boundary.
+#define VRING_USED_OFF(n) PGROUNDUP(sizeof(struct vring_desc)*(n) + 2*(3+(n)))
+#define VRING_SIZE(n) \
+  (VRING_USED_OFF(n) + PGROUNDUP(2*3 + sizeof(struct vring_used_elem)*(n)))
+
+static uchar vqmem[VRING_SIZE(QMAX)] __attribute__((aligned(PGSIZE)));
+
+static struct {
+  struct spinlock lock;
+  ushort iobase;
+  int num;                     // ring size chosen by the device
+  struct vring_desc *desc;
+  struct vring_avail *avail;
+  struct vring_used *used;
+  char free[QMAX];             // is descriptor free?
+  int nfree;
+  ushort usedidx;              // how far we have looked in used->ring
+
+  // Per request, indexed by its first descriptor.
+  struct {
+    struct buf *b;
+    struct virtio_blk_req req;
+    uchar status;
+  } info[QMAX];
+} vdisk;
+
+int havevirtio;
+int virtioirq;
+
+void
+virtioinit(void)
+{
+  uchar bus, slot, func;
+  uint tmp;
+  int i;
+
+  // Transitional virtio-blk: vendor 0x1af4, device 0x1001.
+  if(pcifind(0x1af4, 0x1001, &bus, &slot, &func) < 0)
+    return;
+
+  initlock(&vdisk.lock, "virtio");
+  tmp = read_pci_config(bus, slot, func, PCI_CONFIG_SPACE_STA_CMD);
+  write_pci_config(bus, slot, func, PCI_CONFIG_SPACE_STA_CMD, tmp | 0x5);
+  vdisk.iobase = read_pci_config(bus, slot, func, PCI_CONFIG_SPACE_BAR0) & ~0x3;
+  virtioirq = read_pci_config(bus, slot, func, PCI_CONFIG_SPACE_INTRL) & 0xff;
+
+  // Reset, then tell the device we know how to drive it.
+  outb(vdisk.iobase + VIRTIO_STATUS, 0);
+  outb(vdisk.iobase + VIRTIO_STATUS, VIRTIO_ACKNOWLEDGE);
+  outb(vdisk.iobase + VIRTIO_STATUS, VIRTIO_ACKNOWLEDGE|VIRTIO_DRIVER);
+  // We need none of the optional features.
+  inl(vdisk.iobase + VIRTIO_HOST_FEATURES);
+  outl(vdisk.iobase + VIRTIO_GUEST_FEATURES, 0);
+
+  // Set up request queue 0.
+  outw(vdisk.iobase + VIRTIO_QUEUE_SEL, 0);
+  vdisk.num = inw(vdisk.iobase + VIRTIO_QUEUE_NUM);
+  if(vdisk.num == 0 || vdisk.num > QMAX){
+    cprintf("virtio: unusable queue size %d\n", vdisk.num);
+    outb(vdisk.iobase + VIRTIO_STATUS, 0);
+    return;
+  }
+  vdisk.desc = (struct vring_desc*)vqmem;
+  vdisk.avail = (struct vring_avail*)(vqmem + sizeof(struct vring_desc)*vdisk.num);
+  vdisk.used = (struct vring_used*)(vqmem + VRING_USED_OFF(vdisk.num));
+  for(i = 0; i < vdisk.num; i++)
+    vdisk.free[i] = 1;
+  vdisk.nfree = vdisk.num;
+  outl(vdisk.iobase + VIRTIO_QUEUE_PFN, (uint)vqmem >> PGSHIFT);
+
+  picenable(virtioirq);
+  ioapicenable(virtioirq, ncpu - 1);
+  outb(vdisk.iobase + VIRTIO_STATUS,
+       VIRTIO_ACKNOWLEDGE|VIRTIO_DRIVER|VIRTIO_DRIVER_OK);
+  havevirtio = 1;
+  cprintf("virtio: disk on irq %d, %d ring entries\n", virtioirq, vdisk.num);
+}
+
+// Allocate a free descriptor.  Caller holds vdisk.lock
+// and has checked vdisk.nfree.
+static int
+allocdesc(void)
+{
+  int i;
+
+  for(i = 0; i < vdisk.num; i++){
+    if(vdisk.free[i]){
+      vdisk.free[i] = 0;
+      vdisk.nfree--;
+      return i;
+    }
+  }
+  panic("virtio: allocdesc");
+}
+
+// Free the chain of descriptors starting at i.
+static void
+freechain(int i)
+{
+  for(;;){
+    vdisk.free[i] = 1;
+    vdisk.nfree++;
+    if(!(vdisk.desc[i].flags & VRING_DESC_F_NEXT))
+      break;
+    i = vdisk.desc[i].next;
+  }
+}
+
+// Put a request for b on the available ring.  Caller holds
+// vdisk.lock; the device is not told until the next notify.
+static void
+virtiostart(struct buf *b)
+{
+  int d0, d1, d2;
+
+  d0 = allocdesc();
+  d1 = allocdesc();
+  d2 = allocdesc();
+
+  vdisk.info[d0].b = b;
+  vdisk.info[d0].req.type = (b->flags & B_DIRTY) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  vdisk.info[d0].req.reserved = 0;
+  vdisk.info[d0].req.sector = b->sector;
+  vdisk.info[d0].req.sectorhi = 0;
+  vdisk.info[d0].status = 0xff;
+
+  vdisk.desc[d0].addr = (uint)&vdisk.info[d0].req;
+  vdisk.desc[d0].addrhi = 0;
+  vdisk.desc[d0].len = sizeof(vdisk.info[d0].req);
+  vdisk.desc[d0].flags = VRING_DESC_F_NEXT;
+  vdisk.desc[d0].next = d1;
+
+  vdisk.desc[d1].addr = (uint)b->data;
+  vdisk.desc[d1].addrhi = 0;
+  vdisk.desc[d1].len = b->nsect*512;
+  vdisk.desc[d1].flags = VRING_DESC_F_NEXT;
+  if(!(b->flags & B_DIRTY))
+    vdisk.desc[d1].flags |= VRING_DESC_F_WRITE;
+  vdisk.desc[d1].next = d2;
+
+  vdisk.desc[d2].addr = (uint)&vdisk.info[d0].status;
+  vdisk.desc[d2].addrhi = 0;
+  vdisk.desc[d2].len = 1;
+  vdisk.desc[d2].flags = VRING_DESC_F_WRITE;
+  vdisk.desc[d2].next = 0;
+
+  vdisk.avail->ring[vdisk.avail->idx % vdisk.num] = d0;
+  __sync_synchronize();
+  vdisk.avail->idx++;
+}
+
+// Sync n bufs with disk, with the same contract as iderwv.
+// Everything that fits on the ring is handed to the device
+// with a single notify.
+void
+virtiorwv(struct buf **bv, int n)
+{
+  int i, queued;
+
+  acquire(&vdisk.lock);
+  for(i = 0, queued = 0; i < n; i++){
+    if(!(bv[i]->flags & B_BUSY))
+      panic("virtiorw: buf not busy");
+    if((bv[i]->flags & (B_VALID|B_DIRTY)) == B_VALID)
+      panic("virtiorw: nothing to do");
+    while(vdisk.nfree < 3){
+      // Ring full: let the device drain it.
+      if(queued){
+        __sync_synchronize();
+        outw(vdisk.iobase + VIRTIO_QUEUE_NOTIFY, 0);
+        queued = 0;
+      }
+      sleep(&vdisk.free, &vdisk.lock);
+    }
+    virtiostart(bv[i]);
+    queued++;
+  }
+  if(queued){
+    __sync_synchronize();
+    outw(vdisk.iobase + VIRTIO_QUEUE_NOTIFY, 0);
+  }
+
+  // Wait for requests to finish.
+  for(i = 0; i < n; i++)
+    while((bv[i]->flags & (B_VALID|B_DIRTY)) != B_VALID)
+      sleep(bv[i], &vdisk.lock);
+  release(&vdisk.lock);
+}
+
+// Interrupt handler.  Returns 1 if the interrupt was ours,
+// since the IRQ line may be shared with other PCI devices.
+int
+virtiointr(void)
+{
+  struct buf *b;
+  int id;
+
+  if(!havevirtio)
+    return 0;
+
+  acquire(&vdisk.lock);
+  // Reading the ISR register acknowledges the interrupt.
+  if((inb(vdisk.iobase + VIRTIO_ISR) & 1) == 0){
+    release(&vdisk.lock);
+    return 0;
+  }
+
+  while(vdisk.usedidx != vdisk.used->idx){
+    __sync_synchronize();
+    id = vdisk.used->ring[vdisk.usedidx % vdisk.num].id;
+    if(vdisk.info[id].status != 0)
+      panic("virtio: request failed");
+    b = vdisk.info[id].b;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
+    freechain(id);
+    vdisk.usedidx++;
+  }
+  wakeup(&vdisk.free);
+
+  release(&vdisk.lock);
+  return 1;
+}
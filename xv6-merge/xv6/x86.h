@@ -18,6 +18,15 @@ inw(ushort port)
   return data;
 }
 
+static inline uint
+inl(ushort port)
+{
+  uint data;
+
+  asm volatile("inl %w1,%0" : "=a" (data) : "d" (port));
+  return data;
+}
+
 static inline void
 insl(int port, void *addr, int cnt)
 {
@@ -39,6 +48,12 @@ outw(ushort port, ushort data)
   asm volatile("out %0,%1" : : "a" (data), "d" (port));
 }
 
+static inline void
+outl(ushort port, uint data)
+{
+  asm volatile("outl %0,%w1" : : "a" (data), "d" (port));
+}
+
 static inline void
 outsl(int port, const void *addr, int cnt)
 {
@@ -146,6 +161,16 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Index of the lowest set bit of x, which must not be 0.
+static inline uint
+bsf(uint x)
+{
+  uint r;
+
+  asm("bsf %1,%0" : "=r" (r) : "rm" (x));
+  return r;
+}
+
 static inline void
 lcr0(uint val)
 {